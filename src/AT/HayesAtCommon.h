@@ -11,7 +11,35 @@ namespace hayes
         std::string command;
 
         std::vector<std::string> data;
+
+        // decoded messages: the fields in use at the front of data, the strings after
+        // them are kept for later lines so long fields do not reallocate
+        size_t fields{0};
+    };
+
+    // result of decoding and dispatching one line, malformed input is reported here rather than thrown
+    enum class AtStatus
+    {
+        OK,
+        EMPTY,
+        MALFORMED,
+        TOO_FEW_FIELDS,
+        BAD_FIELD,
+        COUNT
     };
+
+    inline const char* at_status_name(AtStatus status)
+    {
+        switch (status)
+        {
+            case AtStatus::OK: return "ok";
+            case AtStatus::EMPTY: return "empty";
+            case AtStatus::MALFORMED: return "malformed";
+            case AtStatus::TOO_FEW_FIELDS: return "too few fields";
+            case AtStatus::BAD_FIELD: return "bad field";
+            default: return "unknown";
+        }
+    }
 }
 
 
@@ -15,42 +15,85 @@ AtDecoder::AtDecoder()
 {
 }
 
-void AtDecoder::decode(const std::string &raw)
+void AtDecoder::reserve(size_t max_line, size_t max_fields)
+{
+    msg_.command.reserve(max_line);
+    // a field can be as long as the line
+    if (msg_.data.size() < max_fields)
+        msg_.data.resize(max_fields);
+    for (std::string& field : msg_.data) field.reserve(max_line);
+}
+
+AtStatus AtDecoder::decode(std::string_view raw)
 {
 
     if (raw.empty())
-        throw "Bad decode";
+        return AtStatus::EMPTY;
 
-    hayes::AtMsg msg;
+    hayes::AtMsg& msg = msg_;
+    msg.command.clear();
+    msg.fields = 0;
 
     size_t comma_index = raw.find_first_of(',');
     if(comma_index != std::string::npos)
     {
         size_t t_index = raw.find_first_of('T');
+        if (t_index == std::string::npos || t_index + 2 > comma_index)
+            return AtStatus::MALFORMED;
+
         size_t colon_index = raw.find_first_of(':', t_index+2);
+        if (colon_index == std::string::npos || colon_index > comma_index)
+            return AtStatus::MALFORMED;
+
         int read = comma_index - colon_index - 1;
-        msg.command = raw.substr(colon_index+1, read);
-        std::string data = raw.substr(comma_index+1);
-        std::stringstream ss;
-        ss << data;
-        while (ss.good())
+        msg.command.assign(raw.substr(colon_index+1, read));
+
+        size_t start = comma_index + 1;
+        while (true)
         {
-            std::string substr;
-            getline(ss, substr, ',');
-            msg.data.push_back(substr);
+            size_t next = raw.find_first_of(',', start);
+            if (msg.fields == msg.data.size())
+                msg.data.emplace_back();
+            msg.data[msg.fields++].assign(raw.substr(start, next - start));
+            if (next == std::string::npos)
+                break;
+            start = next + 1;
         }
     }
     else
     {
-        msg.command = raw;
+        // a reply to one of our commands: +++AT<command>:<length>:<payload>
+        if (raw.compare(0, 5, "+++AT") != 0)
+            return AtStatus::MALFORMED;
+
+        size_t length_index = raw.find_first_of(':', 5);
+        if (length_index == std::string::npos)
+            return AtStatus::MALFORMED;
+
+        size_t payload_index = raw.find_first_of(':', length_index + 1);
+        if (payload_index == std::string::npos || payload_index == length_index + 1)
+            return AtStatus::MALFORMED;
+
+        size_t length = 0;
+        for (size_t i = length_index + 1; i < payload_index; i++)
+        {
+            if (raw[i] < '0' || raw[i] > '9' || length > raw.size())
+                return AtStatus::MALFORMED;
+            length = length * 10 + (raw[i] - '0');
+        }
+        if (length != raw.size() - payload_index - 1)
+            return AtStatus::MALFORMED;
+
+        msg.command.assign(raw);
     }
 
 
 
     if(cb_)
     {
-        cb_(msg);   
+        return cb_(msg);   
     }
 
+    return AtStatus::OK;
 }
 } //namespace hayes
@@ -10,6 +10,7 @@
 
 #include <sstream>
 #include <functional>
+#include <string_view>
 #include "HayesAtCommon.h"
 
 namespace hayes
@@ -19,16 +20,21 @@ class AtDecoder
 {
 public:
     AtDecoder();
-    void decode(const std::string &);
+    AtStatus decode(std::string_view);
 
-    typedef std::function<void(AtMsg)> DecodeCallback;
+    // preallocate so lines up to max_line bytes with max_fields fields decode without allocating
+    void reserve(size_t max_line, size_t max_fields);
+
+    // the callback's status is passed back out of decode()
+    typedef std::function<AtStatus(const AtMsg&)> DecodeCallback;
     DecodeCallback cb_;
 
     void set_decode_callback(DecodeCallback c) { cb_  = c;}
 
 
 private:
-
+    // reused between lines to avoid allocating
+    AtMsg msg_;
 
 };
 } //namespace hayes
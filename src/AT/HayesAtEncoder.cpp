@@ -16,15 +16,18 @@ AtEncoder::AtEncoder()
 
 void AtEncoder::encode(const AtMsg &at_msg)
 {
-    std::stringstream message;
-
-    message << "+++AT" << at_msg.command;
+    message_.assign("+++AT");
+    message_ += at_msg.command;
 
     for (size_t i = 0; i < at_msg.data.size(); i++)
     {
-        message << "," << at_msg.data.at(i);
+        message_ += ",";
+        message_ += at_msg.data[i];
     }
 
-    cb_(message.str());
+    if (cb_)
+    {
+        cb_(message_);
+    }
 }
 } //namespace hayes
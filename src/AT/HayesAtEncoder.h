@@ -19,13 +19,17 @@ public:
     AtEncoder();
     void encode(const AtMsg &at_msg);
 
-    typedef std::function<void(std::string)> TransmitCallback;
+    // preallocate so commands up to max_line bytes encode without allocating
+    void reserve(size_t max_line) { message_.reserve(max_line); }
+
+    typedef std::function<void(const std::string&)> TransmitCallback;
     TransmitCallback cb_;
 
     void set_transmit_callback(TransmitCallback c) { cb_  = c;}
 
 private:
-
+    // reused between commands to avoid allocating
+    std::string message_;
 
 };
 } //namespace at
@@ -0,0 +1,533 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <algorithm> // for min, max
+#include <chrono>    // for system_clock
+#include <fstream>   // for ifstream
+#include <iterator>  // for istreambuf_iterator
+
+#include "evologics_bulk_transfer.h"
+
+namespace
+{
+// data: magic, 'D', id, segment, total bytes, segments, offset, payload, trailer
+// ack:  magic, 'A', id, first missing segment, bitmap of the 64 segments after it, trailer
+// everything between the type and the trailer is stuffed
+const char BULK_MAGIC[] = "\x1b"
+                          "EVB";
+const size_t BULK_MAGIC_SIZE = 4;
+const char TYPE_DATA = 'D';
+const char TYPE_ACK = 'A';
+// the driver trims a trailing newline from received frames, so never end on payload
+const char TRAILER = '\0';
+// unstuffed sizes of the fields after the type
+const size_t DATA_HEADER_SIZE = 2 + 4 + 4 + 4 + 4;
+const size_t ACK_BODY_SIZE = 2 + 4 + 8;
+const size_t ACK_BITMAP_BITS = 64;
+// finished outgoing transfers and completed incoming ones remembered
+const size_t HISTORY = 8;
+
+// "\r\n" ends a line and "+++" starts an AT message, so '\r' and '+' (and the escape
+// itself) go out as ESCAPE, byte ^ ESCAPE_XOR. '\n' too, so a frame never ends on one.
+const uint8_t ESCAPE = 0x10;
+const uint8_t ESCAPE_XOR = 0x20;
+
+bool needs_stuffing(uint8_t b) { return b == '\r' || b == '\n' || b == '+' || b == ESCAPE; }
+
+size_t stuffed_size(uint8_t b) { return needs_stuffing(b) ? 2 : 1; }
+
+void put_byte(uint8_t b, std::string* out)
+{
+    if (needs_stuffing(b))
+    {
+        out->push_back(static_cast<char>(ESCAPE));
+        b ^= ESCAPE_XOR;
+    }
+    out->push_back(static_cast<char>(b));
+}
+
+void put_uint(uint64_t v, size_t bytes, std::string* out)
+{
+    for (size_t i = 0; i < bytes; i++) put_byte((v >> (8 * i)) & 0xff, out);
+}
+
+// false for a bare special byte or an escape with nothing after it
+bool unstuff(const std::string& in, size_t begin, size_t end, std::string* out)
+{
+    out->clear();
+    for (size_t i = begin; i < end; i++)
+    {
+        uint8_t b = in[i];
+        if (b == ESCAPE)
+        {
+            if (++i == end)
+                return false;
+            b = static_cast<uint8_t>(in[i]) ^ ESCAPE_XOR;
+        }
+        else if (needs_stuffing(b))
+        {
+            return false;
+        }
+        out->push_back(static_cast<char>(b));
+    }
+    return true;
+}
+
+// would the link split the frame or hand part of it to the AT decoder
+bool line_safe(const std::string& frame)
+{
+    return frame.find("\r\n") == std::string::npos && frame.find("+++") == std::string::npos &&
+           (frame.empty() || frame.back() != '\n');
+}
+
+uint64_t get_uint(const std::string& s, size_t pos, size_t bytes)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < bytes; i++)
+        v |= static_cast<uint64_t>(static_cast<uint8_t>(s[pos + i])) << (8 * i);
+    return v;
+}
+} // namespace
+
+namespace goby
+{
+namespace acomms
+{
+
+// every header byte stuffed, plus the trailer
+const size_t EvologicsBulkTransfer::MAX_OVERHEAD = BULK_MAGIC_SIZE + 1 + 2 * DATA_HEADER_SIZE + 1;
+
+EvologicsBulkTransfer::EvologicsBulkTransfer()
+    // differ from the ids used before a restart, which the peer may still remember
+    : next_id_(static_cast<uint16_t>(std::chrono::system_clock::now().time_since_epoch().count()))
+{
+}
+
+uint16_t EvologicsBulkTransfer::send(const std::string& data, double now)
+{
+    Outgoing out;
+    out.id = next_id_++;
+    out.data = data;
+    out.total_bytes = data.size();
+    cut_segments(out);
+    out.acked.assign(out.segments, false);
+    out.sent_at.assign(out.segments, -1);
+    out.send_order.assign(out.segments, 0);
+    out.start = now;
+    outgoing_.push_back(std::move(out));
+    return outgoing_.back().id;
+}
+
+bool EvologicsBulkTransfer::send_file(const std::string& path, double now, uint16_t* id)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    *id = send(data, now);
+    return true;
+}
+
+bool EvologicsBulkTransfer::is_bulk_frame(const std::string& frame)
+{
+    return frame.size() > BULK_MAGIC_SIZE && frame.compare(0, BULK_MAGIC_SIZE, BULK_MAGIC) == 0;
+}
+
+void EvologicsBulkTransfer::on_frame(const std::string& frame, double now)
+{
+    if (frame.size() < BULK_MAGIC_SIZE + 2 || frame.back() != TRAILER ||
+        !unstuff(frame, BULK_MAGIC_SIZE + 1, frame.size() - 1, &body_))
+        return;
+
+    if (frame[BULK_MAGIC_SIZE] == TYPE_DATA)
+        on_data(body_, now);
+    else if (frame[BULK_MAGIC_SIZE] == TYPE_ACK)
+        on_ack(body_, now);
+}
+
+void EvologicsBulkTransfer::do_work(double now)
+{
+    for (auto it = incoming_.begin(); it != incoming_.end();)
+    {
+        Incoming& in = it->second;
+        // the sender gave up or the header was corrupt, make room for others
+        if (now - in.last_rx > cfg_.incoming_timeout)
+        {
+            incoming_bytes_ -= in.total_bytes;
+            it = incoming_.erase(it);
+            continue;
+        }
+
+        if (in.unacked > 0 && now - in.last_rx >= cfg_.ack_delay)
+        {
+            send_ack(it->first, in.first_missing, ack_bitmap(in));
+            in.unacked = 0;
+        }
+        ++it;
+    }
+
+    if (outgoing_.empty())
+        return;
+
+    Outgoing& out = outgoing_.front();
+
+    for (size_t seq = out.first_unacked; seq < out.segments; seq++)
+    {
+        if (!out.acked[seq] && out.sent_at[seq] >= 0 &&
+            now - out.sent_at[seq] > cfg_.retransmit_timeout)
+        {
+            out.sent_at[seq] = -1;
+            out.in_flight--;
+        }
+    }
+
+    // lowest segments first, so lost ones go out again before new ones
+    for (size_t seq = out.first_unacked; seq < out.segments && out.in_flight < cfg_.window; seq++)
+    {
+        if (!out.acked[seq] && out.sent_at[seq] < 0)
+            send_segment(out, seq, now);
+    }
+
+    // every segment is acknowledged but not the transfer: the final acknowledgement was lost,
+    // or the receiver dropped its copy. The answer to a segment sent again tells which
+    if (out.segments_acked == out.segments && now - out.last_sent > cfg_.retransmit_timeout)
+        send_segment(out, out.segments - 1, now);
+}
+
+void EvologicsBulkTransfer::link_restored()
+{
+    if (outgoing_.empty())
+        return;
+
+    Outgoing& out = outgoing_.front();
+    for (size_t seq = out.first_unacked; seq < out.segments; seq++)
+    {
+        if (!out.acked[seq] && out.sent_at[seq] >= 0)
+        {
+            out.sent_at[seq] = -1;
+            out.in_flight--;
+        }
+    }
+}
+
+bool EvologicsBulkTransfer::progress(uint16_t id, double now, Progress* p) const
+{
+    for (const std::deque<Outgoing>* list : {&outgoing_, &finished_})
+    {
+        for (const Outgoing& out : *list)
+        {
+            if (out.id == id)
+            {
+                *p = make_progress(out, now);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void EvologicsBulkTransfer::cut_segments(Outgoing& out) const
+{
+    // room for one stuffed byte at least, so every segment moves the transfer on
+    size_t budget = std::max<size_t>(2, cfg_.segment_size);
+
+    // an empty buffer is still one (empty) segment, so the receiver hears about it
+    out.offsets.assign(1, 0);
+    size_t stuffed = 0;
+    for (size_t i = 0; i < out.total_bytes; i++)
+    {
+        size_t n = stuffed_size(out.data[i]);
+        if (stuffed + n > budget)
+        {
+            out.offsets.push_back(i);
+            stuffed = 0;
+        }
+        stuffed += n;
+    }
+    out.offsets.push_back(out.total_bytes);
+    out.segments = out.offsets.size() - 1;
+}
+
+void EvologicsBulkTransfer::send_segment(Outgoing& out, size_t seq, double now)
+{
+    size_t offset = out.offsets[seq];
+
+    frame_.assign(BULK_MAGIC, BULK_MAGIC_SIZE);
+    frame_.push_back(TYPE_DATA);
+    put_uint(out.id, 2, &frame_);
+    put_uint(seq, 4, &frame_);
+    put_uint(out.total_bytes, 4, &frame_);
+    put_uint(out.segments, 4, &frame_);
+    put_uint(offset, 4, &frame_);
+    for (size_t i = offset; i < out.offsets[seq + 1]; i++) put_byte(out.data[i], &frame_);
+    frame_.push_back(TRAILER);
+
+    // goodput is timed from the first segment, not from when the transfer was queued
+    if (out.segments_sent == 0)
+        out.start = now;
+    if (out.send_order[seq] != 0)
+        out.retransmissions++;
+    out.send_order[seq] = ++send_counter_;
+    out.last_sent = now;
+    out.segments_sent++;
+    // an acknowledged segment sent again only asks for the transfer's state, it is not in flight
+    if (!out.acked[seq])
+    {
+        out.sent_at[seq] = now;
+        out.in_flight++;
+    }
+
+    send_frame();
+}
+
+void EvologicsBulkTransfer::on_data(const std::string& body, double now)
+{
+    if (body.size() < DATA_HEADER_SIZE)
+        return;
+    size_t bytes = body.size() - DATA_HEADER_SIZE;
+
+    uint16_t id = get_uint(body, 0, 2);
+    size_t seq = get_uint(body, 2, 4);
+    size_t total_bytes = get_uint(body, 6, 4);
+    size_t segments = get_uint(body, 10, 4);
+    size_t offset = get_uint(body, 14, 4);
+
+    // every segment but an empty transfer's only one carries at least a byte
+    if (total_bytes > cfg_.max_transfer_bytes || segments == 0 ||
+        segments > std::max<size_t>(1, total_bytes) || seq >= segments || offset > total_bytes ||
+        bytes > total_bytes - offset)
+        return;
+
+    // already delivered, the sender missed our final acknowledgement
+    for (const auto& c : completed_)
+    {
+        if (c.first == id && c.second == segments)
+        {
+            send_ack(id, segments, 0);
+            return;
+        }
+    }
+
+    auto it = incoming_.find(id);
+    if (it != incoming_.end() &&
+        (it->second.total_bytes != total_bytes || it->second.segments != segments))
+    {
+        // the id was reused for a different transfer
+        incoming_bytes_ -= it->second.total_bytes;
+        incoming_.erase(it);
+        it = incoming_.end();
+    }
+
+    if (it == incoming_.end())
+    {
+        // full: unacknowledged, the sender retries once a transfer completes or times out
+        if (incoming_.size() >= cfg_.max_incoming_transfers ||
+            total_bytes > cfg_.max_incoming_bytes - std::min(cfg_.max_incoming_bytes, incoming_bytes_))
+            return;
+
+        Incoming in;
+        in.total_bytes = total_bytes;
+        in.segments = segments;
+        it = incoming_.emplace(id, std::move(in)).first;
+        incoming_bytes_ += total_bytes;
+    }
+
+    Incoming& in = it->second;
+    if (!in.received.count(seq))
+    {
+        in.received.emplace(seq, std::make_pair(offset, body.substr(DATA_HEADER_SIZE)));
+        while (in.first_missing < segments && in.received.count(in.first_missing)) in.first_missing++;
+    }
+    in.unacked++;
+    in.last_rx = now;
+
+    if (in.received.size() == segments)
+    {
+        // take it out of incoming_ before the callback, which may send
+        std::string data;
+        bool ok = assemble(in, &data);
+        incoming_bytes_ -= in.total_bytes;
+        incoming_.erase(it);
+
+        // segments that do not tile the buffer: start over rather than deliver it
+        if (!ok)
+            return;
+
+        send_ack(id, segments, 0);
+
+        completed_.emplace_back(id, segments);
+        if (completed_.size() > HISTORY)
+            completed_.pop_front();
+
+        if (receive_callback_)
+        {
+            receive_callback_(id, data);
+        }
+    }
+    else if (in.unacked >= cfg_.ack_every)
+    {
+        send_ack(id, in.first_missing, ack_bitmap(in));
+        in.unacked = 0;
+    }
+}
+
+void EvologicsBulkTransfer::on_ack(const std::string& body, double now)
+{
+    if (body.size() != ACK_BODY_SIZE || outgoing_.empty())
+        return;
+
+    Outgoing& out = outgoing_.front();
+    if (get_uint(body, 0, 2) != out.id)
+        return;
+
+    size_t first_missing = get_uint(body, 2, 4);
+    uint64_t bitmap = get_uint(body, 6, 8);
+
+    // the receiver no longer holds a segment it acknowledged, so it dropped the transfer
+    if (first_missing < out.segments && out.acked[first_missing])
+        restart(out);
+
+    size_t acked_before = out.segments_acked;
+    uint64_t newest_acked = 0;
+    auto ack = [&](size_t seq) {
+        if (seq >= out.segments || out.acked[seq])
+            return;
+        out.acked[seq] = true;
+        out.segments_acked++;
+        out.acked_bytes += out.offsets[seq + 1] - out.offsets[seq];
+        if (out.sent_at[seq] >= 0)
+            out.in_flight--;
+        newest_acked = std::max(newest_acked, out.send_order[seq]);
+    };
+
+    for (size_t seq = out.first_unacked; seq < std::min(first_missing, out.segments); seq++)
+        ack(seq);
+    for (size_t i = 0; i < ACK_BITMAP_BITS; i++)
+    {
+        if (bitmap & (uint64_t(1) << i))
+            ack(first_missing + 1 + i);
+    }
+
+    while (out.first_unacked < out.segments && out.acked[out.first_unacked]) out.first_unacked++;
+
+    // frames arrive in order, so anything sent before an acknowledged segment and still missing was lost
+    for (size_t seq = out.first_unacked; seq < out.segments; seq++)
+    {
+        if (!out.acked[seq] && out.sent_at[seq] >= 0 && out.send_order[seq] < newest_acked)
+        {
+            out.sent_at[seq] = -1;
+            out.in_flight--;
+        }
+    }
+
+    // only the receiver's acknowledgement of the whole transfer says it was assembled
+    bool complete = first_missing == out.segments;
+    if (out.segments_acked == acked_before && !complete)
+        return;
+
+    if (complete)
+    {
+        out.complete = true;
+        out.end = now;
+    }
+
+    if (progress_callback_)
+    {
+        progress_callback_(make_progress(out, now));
+    }
+
+    if (complete)
+    {
+        Outgoing done = std::move(outgoing_.front());
+        outgoing_.pop_front();
+        done.data.clear();
+        done.data.shrink_to_fit();
+        finished_.push_back(std::move(done));
+        if (finished_.size() > HISTORY)
+            finished_.pop_front();
+    }
+}
+
+void EvologicsBulkTransfer::restart(Outgoing& out)
+{
+    out.acked.assign(out.segments, false);
+    out.sent_at.assign(out.segments, -1);
+    out.first_unacked = 0;
+    out.segments_acked = 0;
+    out.acked_bytes = 0;
+    out.in_flight = 0;
+}
+
+uint64_t EvologicsBulkTransfer::ack_bitmap(const Incoming& in)
+{
+    uint64_t bitmap = 0;
+    for (auto it = in.received.upper_bound(in.first_missing);
+         it != in.received.end() && it->first <= in.first_missing + ACK_BITMAP_BITS; ++it)
+        bitmap |= uint64_t(1) << (it->first - in.first_missing - 1);
+    return bitmap;
+}
+
+bool EvologicsBulkTransfer::assemble(const Incoming& in, std::string* data)
+{
+    data->reserve(in.total_bytes);
+    for (const auto& p : in.received)
+    {
+        if (p.second.first != data->size())
+            return false;
+        data->append(p.second.second);
+    }
+    return data->size() == in.total_bytes;
+}
+
+void EvologicsBulkTransfer::send_ack(uint16_t id, size_t first_missing, uint64_t bitmap)
+{
+    frame_.assign(BULK_MAGIC, BULK_MAGIC_SIZE);
+    frame_.push_back(TYPE_ACK);
+    put_uint(id, 2, &frame_);
+    put_uint(first_missing, 4, &frame_);
+    put_uint(bitmap, 8, &frame_);
+    frame_.push_back(TRAILER);
+
+    send_frame();
+}
+
+void EvologicsBulkTransfer::send_frame()
+{
+    // stuffing should make this impossible, but a frame the link would split never goes out
+    if (!line_safe(frame_))
+    {
+        unsafe_frames_++;
+        return;
+    }
+
+    if (frame_callback_)
+    {
+        frame_callback_(frame_);
+    }
+}
+
+EvologicsBulkTransfer::Progress EvologicsBulkTransfer::make_progress(const Outgoing& out,
+                                                                     double now) const
+{
+    Progress p;
+    p.id = out.id;
+    p.total_bytes = out.total_bytes;
+    p.segments = out.segments;
+    p.segments_acked = out.segments_acked;
+    p.complete = out.complete;
+    p.acked_bytes = out.acked_bytes;
+
+    p.segments_sent = out.segments_sent;
+    p.retransmissions = out.retransmissions;
+    p.elapsed = (p.complete ? out.end : now) - out.start;
+    p.goodput = p.elapsed > 0 ? p.acked_bytes / p.elapsed : 0;
+    return p;
+}
+
+} // namespace acomms
+} // namespace goby
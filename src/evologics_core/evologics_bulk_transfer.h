@@ -0,0 +1,200 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_BULK_TRANSFER_H
+#define GOBY_ACOMMS_MODEMDRIVER_EVO_BULK_TRANSFER_H
+
+#include <cstddef>    // for size_t
+#include <cstdint>    // for uint16_t, uint32_t, uint64_t
+#include <deque>      // for deque
+#include <functional> // for function
+#include <map>        // for map
+#include <string>     // for string
+#include <utility>    // for pair
+#include <vector>     // for vector
+
+namespace goby
+{
+namespace acomms
+{
+/// \class EvologicsBulkTransfer evologics_bulk_transfer.h
+/// \brief Sliding window transfer of large buffers over burst data frames.
+///
+/// A buffer is cut into numbered segments; up to window of them are in flight at
+/// once. Frames are byte stuffed so they never hold "\r\n" or "+++", which would split
+/// them on the line based link, and segments are cut so each stays within segment_size
+/// once stuffed. The receiver answers with selective acknowledgements (the first missing
+/// segment plus a bitmap of the 64 after it). A segment is sent again when a later
+/// one sent after it has been acknowledged, or when retransmit_timeout passes without
+/// an acknowledgement. A transfer is complete only once the receiver acknowledges all of
+/// it, after assembling it; until then a segment is sent again every retransmit_timeout.
+/// State lives in memory on both ends, so a transfer carries on from where it was when
+/// the link comes back. Should the receiver have dropped its copy meanwhile (gone
+/// incoming_timeout without hearing from it, failed to assemble it, or restarted), its next
+/// acknowledgement shows a segment it acknowledged before as missing, and the sender
+/// starts the transfer over. Incoming segments are stored as they arrive, and the number
+/// and total size of incoming transfers are capped. Outgoing transfers run one at a time
+/// in the order they were queued. All times are in seconds on any monotonic clock.
+class EvologicsBulkTransfer
+{
+  public:
+    struct Config
+    {
+        // payload bytes per data frame after stuffing, framing adds at most MAX_OVERHEAD
+        size_t segment_size{940};
+        // segments in flight without an acknowledgement
+        size_t window{8};
+        double retransmit_timeout{60};
+        // the receiver acknowledges after this many segments, or once the sender has been quiet for ack_delay
+        size_t ack_every{8};
+        double ack_delay{2};
+        // largest incoming transfer accepted
+        size_t max_transfer_bytes{16 * 1024 * 1024};
+        // incoming transfers held at once, and the sum of their sizes; others wait until one ends
+        size_t max_incoming_transfers{4};
+        size_t max_incoming_bytes{32 * 1024 * 1024};
+        // an incoming transfer nothing has arrived for in this long is dropped
+        double incoming_timeout{900};
+    };
+
+    struct Progress
+    {
+        uint16_t id;
+        size_t total_bytes;
+        size_t acked_bytes;
+        size_t segments;
+        size_t segments_acked;
+        uint64_t segments_sent;
+        uint64_t retransmissions;
+        double elapsed;
+        // acknowledged payload bytes per second
+        double goodput;
+        bool complete;
+    };
+
+    // a frame to put on the link
+    typedef std::function<void(const std::string&)> FrameCallback;
+    // a completed incoming transfer
+    typedef std::function<void(uint16_t, const std::string&)> ReceiveCallback;
+    // outgoing progress, after every acknowledgement that moves it on
+    typedef std::function<void(const Progress&)> ProgressCallback;
+
+    static const size_t MAX_OVERHEAD;
+
+    EvologicsBulkTransfer();
+
+    void set_config(const Config& cfg) { cfg_ = cfg; }
+
+    /// \brief Queue a buffer for transfer. Returns its id.
+    uint16_t send(const std::string& data, double now);
+
+    /// \brief Queue the contents of a file for transfer.
+    bool send_file(const std::string& path, double now, uint16_t* id);
+
+    /// \brief True if a frame as received from the link belongs to a bulk transfer rather than
+    /// the application. Application frames starting with 0x1b are escaped by
+    /// EvologicsCompression::encode(), so match before EvologicsCompression::decode().
+    static bool is_bulk_frame(const std::string& frame);
+
+    /// \brief Handle a received bulk frame (data or acknowledgement).
+    void on_frame(const std::string& frame, double now);
+
+    /// \brief Send what the window allows, retransmit and send delayed acknowledgements.
+    void do_work(double now);
+
+    /// \brief Frames in flight while the link was down are presumed lost.
+    void link_restored();
+
+    /// \brief Progress of an outgoing transfer still queued, in progress or just finished.
+    bool progress(uint16_t id, double now, Progress* p) const;
+
+    bool sending() const { return !outgoing_.empty(); }
+
+    /// \brief Frames dropped because the link would have split them (see MAX_OVERHEAD).
+    uint64_t unsafe_frames() const { return unsafe_frames_; }
+
+    void set_frame_callback(FrameCallback c) { frame_callback_ = c; }
+    void set_receive_callback(ReceiveCallback c) { receive_callback_ = c; }
+    void set_progress_callback(ProgressCallback c) { progress_callback_ = c; }
+
+  private:
+    struct Outgoing
+    {
+        uint16_t id;
+        // released once the transfer finishes
+        std::string data;
+        size_t total_bytes;
+        size_t segments;
+        // segment n is data[offsets[n], offsets[n + 1])
+        std::vector<size_t> offsets;
+        std::vector<bool> acked;
+        // negative while not in flight: before the first send and once presumed lost
+        std::vector<double> sent_at;
+        // order of the latest send, to tell which gaps an acknowledgement proves lost
+        std::vector<uint64_t> send_order;
+        size_t first_unacked{0};
+        size_t segments_acked{0};
+        size_t acked_bytes{0};
+        size_t in_flight{0};
+        uint64_t segments_sent{0};
+        uint64_t retransmissions{0};
+        double start{0};
+        double end{0};
+        // the last segment sent, and whether the receiver has acknowledged the whole transfer
+        double last_sent{0};
+        bool complete{false};
+    };
+
+    struct Incoming
+    {
+        size_t total_bytes;
+        size_t segments;
+        // offset and payload by segment, only what has arrived is stored
+        std::map<size_t, std::pair<size_t, std::string>> received;
+        // first segment not yet received
+        size_t first_missing{0};
+        size_t unacked{0};
+        double last_rx{0};
+    };
+
+    void cut_segments(Outgoing& out) const;
+    void send_segment(Outgoing& out, size_t seq, double now);
+    static void restart(Outgoing& out);
+    void on_data(const std::string& body, double now);
+    void on_ack(const std::string& body, double now);
+    void send_ack(uint16_t id, size_t first_missing, uint64_t bitmap);
+    static uint64_t ack_bitmap(const Incoming& in);
+    static bool assemble(const Incoming& in, std::string* data);
+    void send_frame();
+    Progress make_progress(const Outgoing& out, double now) const;
+
+    Config cfg_;
+    uint16_t next_id_;
+    uint64_t send_counter_{0};
+    uint64_t unsafe_frames_{0};
+
+    std::deque<Outgoing> outgoing_;
+    // finished outgoing transfers, kept for progress()
+    std::deque<Outgoing> finished_;
+
+    std::map<uint16_t, Incoming> incoming_;
+    // sum of total_bytes over incoming_
+    size_t incoming_bytes_{0};
+    // completed incoming transfers (id, segments), so a lost final acknowledgement can be repeated
+    std::deque<std::pair<uint16_t, size_t>> completed_;
+
+    // reused for every frame sent, and for the unstuffed body of every frame received
+    std::string frame_;
+    std::string body_;
+
+    FrameCallback frame_callback_;
+    ReceiveCallback receive_callback_;
+    ProgressCallback progress_callback_;
+};
+} // namespace acomms
+} // namespace goby
+#endif
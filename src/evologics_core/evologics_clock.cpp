@@ -0,0 +1,105 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <algorithm> // for min
+
+#include "evologics_clock.h"
+
+namespace goby
+{
+namespace acomms
+{
+
+EvologicsClock::EvologicsClock() : samples_(64)
+{
+}
+
+void EvologicsClock::set_window(size_t n)
+{
+    samples_.assign(n < 2 ? 2 : n, Sample{0, 0});
+    reset();
+}
+
+void EvologicsClock::add_sample(double modem_time, double host_time)
+{
+    // the modem clock went backwards, it has been restarted
+    if (count_ > 0 && modem_time < sample(count_ - 1).modem)
+        reset();
+
+    if (count_ < samples_.size())
+    {
+        count_++;
+    }
+    else
+    {
+        first_ = (first_ + 1) % samples_.size();
+    }
+    samples_[(first_ + count_ - 1) % samples_.size()] = {modem_time, host_time};
+
+    fit();
+}
+
+double EvologicsClock::to_host(double modem_time) const
+{
+    if (count_ == 0)
+        return modem_time;
+
+    return modem_time + offset_ + drift_ * (modem_time - reference_);
+}
+
+void EvologicsClock::reset()
+{
+    first_ = 0;
+    count_ = 0;
+    reference_ = 0;
+    offset_ = 0;
+    drift_ = 0;
+}
+
+void EvologicsClock::fit()
+{
+    reference_ = sample(count_ - 1).modem;
+
+    // least squares slope of (host - modem) against modem time
+    drift_ = 0;
+    if (count_ >= 2)
+    {
+        double mean_x = 0, mean_y = 0;
+        for (size_t i = 0; i < count_; i++)
+        {
+            const Sample& s = sample(i);
+            mean_x += s.modem - reference_;
+            mean_y += s.host - s.modem;
+        }
+        mean_x /= count_;
+        mean_y /= count_;
+
+        double sxx = 0, sxy = 0;
+        for (size_t i = 0; i < count_; i++)
+        {
+            const Sample& s = sample(i);
+            double dx = s.modem - reference_ - mean_x;
+            sxx += dx * dx;
+            sxy += dx * (s.host - s.modem - mean_y);
+        }
+        if (sxx > 0)
+            drift_ = sxy / sxx;
+    }
+
+    // lower envelope, the least delayed sample is the closest to the true offset
+    bool first = true;
+    for (size_t i = 0; i < count_; i++)
+    {
+        const Sample& s = sample(i);
+        double o = s.host - s.modem - drift_ * (s.modem - reference_);
+        offset_ = first ? o : std::min(offset_, o);
+        first = false;
+    }
+}
+
+} // namespace acomms
+} // namespace goby
@@ -0,0 +1,71 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_CLOCK_H
+#define GOBY_ACOMMS_MODEMDRIVER_EVO_CLOCK_H
+
+#include <cstddef> // for size_t
+#include <vector>  // for vector
+
+namespace goby
+{
+namespace acomms
+{
+/// \class EvologicsClock evologics_clock.h
+/// \brief Online estimate of the modem clock relative to the host clock.
+///
+/// Fits host = modem + offset + drift * (modem - reference) over a sliding window
+/// of (modem time, host arrival time) pairs. Arrival times only ever lag the
+/// modem by a positive transport delay, so the drift comes from a least squares
+/// fit and the offset from the sample with the smallest delay.
+class EvologicsClock
+{
+  public:
+    EvologicsClock();
+
+    /// \brief Add a modem timestamp and the host time (seconds) its line arrived at.
+    void add_sample(double modem_time, double host_time);
+
+    /// \brief Convert a modem timestamp to host time. Returns modem_time unchanged before the first sample.
+    double to_host(double modem_time) const;
+
+    /// \brief Host minus modem time at the reference point, in seconds.
+    double offset() const { return offset_; }
+
+    /// \brief Modem clock drift relative to the host, in seconds per second.
+    double drift() const { return drift_; }
+
+    size_t sample_count() const { return count_; }
+
+    /// \brief Number of samples kept for the fit. Clears the model.
+    void set_window(size_t n);
+
+    void reset();
+
+  private:
+    struct Sample
+    {
+        double modem;
+        double host;
+    };
+
+    void fit();
+    const Sample& sample(size_t i) const { return samples_[(first_ + i) % samples_.size()]; }
+
+    // fixed size ring, oldest sample at first_
+    std::vector<Sample> samples_;
+    size_t first_{0};
+    size_t count_{0};
+
+    // modem time the fit is centred on, keeps the arithmetic well conditioned
+    double reference_{0};
+    double offset_{0};
+    double drift_{0};
+};
+} // namespace acomms
+} // namespace goby
+#endif
@@ -0,0 +1,205 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <algorithm> // for reverse
+#include <utility>   // for move
+
+#include "evologics_command_queue.h"
+
+namespace goby
+{
+namespace acomms
+{
+namespace
+{
+// the command without its value, e.g. "@ZX" for "@ZX1"
+size_t name_length(const std::string& command)
+{
+    size_t n = 0;
+    while (n < command.size() && command[n] != '-' && (command[n] < '0' || command[n] > '9'))
+        n++;
+    return n;
+}
+} // namespace
+
+EvologicsCommandQueue::~EvologicsCommandQueue()
+{
+    std::vector<Command> pending;
+    drain(&pending);
+    for (Command& c : pending) c.promise.set_value(Result::CANCELLED);
+
+    for (Awaiting& a : awaiting_) a.promise.set_value(Result::CANCELLED);
+
+    for (size_t i = 0; i < deferred_.size(); i++)
+    {
+        if (deferred_held_[i])
+            deferred_[i].set_value(Result::CANCELLED);
+    }
+}
+
+EvologicsCommandQueue::Handle EvologicsCommandQueue::submit_setting(EvologicsSetting setting,
+                                                                    int value)
+{
+    Node* node = new Node;
+    node->command.is_setting = true;
+    node->command.setting = setting;
+    node->command.value = value;
+    node->command.coalesce = true;
+    return push(node);
+}
+
+EvologicsCommandQueue::Handle EvologicsCommandQueue::submit_command(const std::string& command,
+                                                                    bool coalesce)
+{
+    Node* node = new Node;
+    node->command.command = command;
+    node->command.coalesce = coalesce;
+    return push(node);
+}
+
+EvologicsCommandQueue::Handle EvologicsCommandQueue::push(Node* node)
+{
+    // taken before the push, after it the node belongs to the draining thread
+    Handle handle = node->command.promise.get_future();
+
+    node->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                        std::memory_order_relaxed))
+    {
+    }
+    return handle;
+}
+
+bool EvologicsCommandQueue::same_target(const Command& a, const Command& b)
+{
+    if (a.is_setting || b.is_setting)
+        return a.is_setting && b.is_setting && a.setting == b.setting;
+
+    size_t n = name_length(a.command);
+    return n == name_length(b.command) && a.command.compare(0, n, b.command, 0, n) == 0;
+}
+
+void EvologicsCommandQueue::drain(std::vector<Command>* out)
+{
+    out->clear();
+
+    // the whole stack at once, so producers never contend with us for a node
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+    while (node)
+    {
+        Node* next = node->next;
+        out->push_back(std::move(node->command));
+        delete node;
+        node = next;
+    }
+    std::reverse(out->begin(), out->end());
+
+    // coalesce runs between commands that cannot be, keeping the first position and the last value
+    size_t kept = 0;
+    size_t run_start = 0;
+    for (size_t i = 0; i < out->size(); i++)
+    {
+        Command& c = (*out)[i];
+        if (!c.coalesce)
+        {
+            if (kept != i)
+                (*out)[kept] = std::move(c);
+            run_start = ++kept;
+            continue;
+        }
+
+        size_t j = run_start;
+        while (j < kept && !((*out)[j].coalesce && same_target((*out)[j], c))) j++;
+
+        if (j < kept)
+        {
+            (*out)[j].promise.set_value(Result::SUPERSEDED);
+            (*out)[j].value = c.value;
+            (*out)[j].command = std::move(c.command);
+            (*out)[j].promise = std::move(c.promise);
+        }
+        else
+        {
+            if (kept != i)
+                (*out)[kept] = std::move(c);
+            kept++;
+        }
+    }
+    out->resize(kept);
+}
+
+void EvologicsCommandQueue::await_reply(const std::string& command, std::promise<Result> p,
+                                        double now)
+{
+    awaiting_.push_back({false, EvologicsSetting::COUNT, command.substr(0, name_length(command)),
+                         std::move(p), now + reply_timeout_});
+}
+
+void EvologicsCommandQueue::defer(EvologicsSetting setting, std::promise<Result> p)
+{
+    size_t i = static_cast<size_t>(setting);
+    if (deferred_held_[i])
+        deferred_[i].set_value(Result::SUPERSEDED);
+    deferred_[i] = std::move(p);
+    deferred_held_[i] = true;
+}
+
+void EvologicsCommandQueue::setting_written(EvologicsSetting setting, double now)
+{
+    size_t i = static_cast<size_t>(setting);
+    if (!deferred_held_[i])
+        return;
+    deferred_held_[i] = false;
+    awaiting_.push_back({true, setting, std::string(), std::move(deferred_[i]), now + reply_timeout_});
+}
+
+void EvologicsCommandQueue::resolve_deferred(EvologicsSetting setting, Result result)
+{
+    size_t i = static_cast<size_t>(setting);
+    if (!deferred_held_[i])
+        return;
+    deferred_held_[i] = false;
+    deferred_[i].set_value(result);
+}
+
+bool EvologicsCommandQueue::on_reply(const std::string& command, bool ok)
+{
+    // "!L" is a prefix of "!LC1", so settings are told apart by the full command
+    EvologicsSetting setting = EvologicsSetting::COUNT;
+    bool setting_write = !command.empty() && command[0] == '!' &&
+                         EvologicsSettings::from_command(command, &setting);
+    size_t n = name_length(command);
+
+    for (auto it = awaiting_.begin(); it != awaiting_.end(); ++it)
+    {
+        bool match = it->is_setting ? setting_write && it->setting == setting
+                                    : it->name.size() == n && command.compare(0, n, it->name) == 0;
+        if (!match)
+            continue;
+        it->promise.set_value(ok ? Result::OK : Result::ERROR);
+        awaiting_.erase(it);
+        return true;
+    }
+    return false;
+}
+
+void EvologicsCommandQueue::expire(double now)
+{
+    for (auto it = awaiting_.begin(); it != awaiting_.end();)
+    {
+        if (it->deadline > now)
+        {
+            ++it;
+            continue;
+        }
+        it->promise.set_value(Result::TIMEOUT);
+        it = awaiting_.erase(it);
+    }
+}
+
+} // namespace acomms
+} // namespace goby
@@ -0,0 +1,139 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_COMMAND_QUEUE_H
+#define GOBY_ACOMMS_MODEMDRIVER_EVO_COMMAND_QUEUE_H
+
+#include <array>   // for array
+#include <atomic>  // for atomic
+#include <deque>   // for deque
+#include <future>  // for future, promise
+#include <string>  // for string
+#include <vector>  // for vector
+
+#include "evologics_settings.h"
+
+namespace goby
+{
+namespace acomms
+{
+/// \class EvologicsCommandQueue evologics_command_queue.h
+/// \brief Control commands submitted from any thread, issued by the thread that owns the link.
+///
+/// Submitters push onto a lock-free stack and get a future for the outcome back. The
+/// owner drains it once per tick, oldest first. Within a drain, a setting written
+/// several times is issued once with the last value, and the earlier submissions
+/// complete as SUPERSEDED. Commands submitted with coalesce set collapse the same way
+/// with others of the same name (the command up to its value, "@ZX" for "@ZX1"). Other
+/// commands (e.g. "&W") are issued in order and nothing is coalesced across them.
+///
+/// Everything but the submit functions belongs to the owning thread. Issued commands
+/// complete when the modem's reply comes back, or with TIMEOUT if it never does.
+class EvologicsCommandQueue
+{
+  public:
+    enum class Result
+    {
+        OK,
+        // the modem replied with an error
+        ERROR,
+        // a later submission for the same setting replaced it before it was issued
+        SUPERSEDED,
+        // no reply within the reply timeout
+        TIMEOUT,
+        // the queue was destroyed first
+        CANCELLED
+    };
+
+    typedef std::future<Result> Handle;
+
+    struct Command
+    {
+        // false for a plain AT command
+        bool is_setting{false};
+        EvologicsSetting setting{EvologicsSetting::COUNT};
+        int value{0};
+        std::string command;
+        bool coalesce{false};
+        std::promise<Result> promise;
+    };
+
+    EvologicsCommandQueue() = default;
+    ~EvologicsCommandQueue();
+
+    EvologicsCommandQueue(const EvologicsCommandQueue&) = delete;
+    EvologicsCommandQueue& operator=(const EvologicsCommandQueue&) = delete;
+
+    /// \brief Ask for a setting to be written. Safe from any thread.
+    Handle submit_setting(EvologicsSetting setting, int value);
+
+    /// \brief Ask for an AT command (without the AT prefix) to be sent. Safe from any thread.
+    Handle submit_command(const std::string& command, bool coalesce);
+
+    /// \brief Take everything submitted so far, oldest first and coalesced, into out.
+    /// out is cleared first and its capacity is reused.
+    void drain(std::vector<Command>* out);
+
+    /// \brief Seconds an issued command waits for its reply.
+    void set_reply_timeout(double seconds) { reply_timeout_ = seconds; }
+
+    /// \brief Complete p on the next reply to a command of the same name as command
+    /// ("@ZX" for "@ZX1", so "!L" never takes the reply to "!LC1").
+    void await_reply(const std::string& command, std::promise<Result> p, double now);
+
+    /// \brief Hold p until the setting is written (see setting_written()) or resolve_deferred().
+    /// A completion already held for the setting is SUPERSEDED.
+    void defer(EvologicsSetting setting, std::promise<Result> p);
+
+    /// \brief The owner wrote the setting to the modem, so a held completion waits for the reply.
+    void setting_written(EvologicsSetting setting, double now);
+
+    /// \brief Complete a held completion without a write, e.g. the modem already had the value.
+    void resolve_deferred(EvologicsSetting setting, Result result);
+
+    /// \brief A reply to one of our commands, e.g. "!G1" with ok false for an ERROR payload.
+    /// Completes the oldest awaiting command it matches, returns false if none does. A
+    /// setting write only matches a write of that exact setting (see EvologicsSettings::from_command()).
+    bool on_reply(const std::string& command, bool ok);
+
+    /// \brief Complete awaiting commands whose reply is overdue with TIMEOUT.
+    void expire(double now);
+
+    /// \brief Issued commands still waiting for their reply.
+    size_t awaiting() const { return awaiting_.size(); }
+
+  private:
+    struct Node
+    {
+        Command command;
+        Node* next{nullptr};
+    };
+
+    struct Awaiting
+    {
+        // a setting write, matched by setting rather than by name
+        bool is_setting;
+        EvologicsSetting setting;
+        std::string name;
+        std::promise<Result> promise;
+        double deadline;
+    };
+
+    Handle push(Node* node);
+    static bool same_target(const Command& a, const Command& b);
+
+    // newest first, taken whole by drain()
+    std::atomic<Node*> head_{nullptr};
+
+    std::deque<Awaiting> awaiting_;
+    std::array<bool, static_cast<size_t>(EvologicsSetting::COUNT)> deferred_held_{};
+    std::array<std::promise<Result>, static_cast<size_t>(EvologicsSetting::COUNT)> deferred_;
+    double reply_timeout_{10};
+};
+} // namespace acomms
+} // namespace goby
+#endif
@@ -0,0 +1,451 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <algorithm> // for fill, min, copy
+#include <chrono>    // for steady_clock
+#include <cstring>   // for memcpy
+#include <fstream>   // for ifstream
+#include <iterator>  // for istreambuf_iterator
+
+#include "evologics_compression.h"
+
+namespace
+{
+// offer frame: magic, version, flags, dictionary count, then (id, content hash) per dictionary
+const char OFFER_MAGIC[] = "\x1b"
+                           "EVZ";
+const size_t OFFER_MAGIC_SIZE = 4;
+const size_t OFFER_HEADER_SIZE = OFFER_MAGIC_SIZE + 3;
+const size_t OFFER_ENTRY_SIZE = 5;
+const uint8_t OFFER_VERSION = 2;
+// the sender has the receiver's offer
+const uint8_t OFFER_HAVE_PEER = 0x01;
+// the sender does not know whether the receiver has its offer, answer with ours
+const uint8_t OFFER_NEED_REPLY = 0x02;
+
+// compressed frames are FRAME_TAG, TAG_COMPRESSED | id, then the sequences. Every raw frame
+// that starts with FRAME_TAG is escaped behind FRAME_TAG, TAG_RAW, so no data frame can be
+// taken for an offer or a bulk transfer frame ("\x1bEVB"); any other goes out as it is.
+const uint8_t FRAME_TAG = 0x1b;
+const uint8_t TAG_RAW = 0x00;
+const uint8_t TAG_COMPRESSED = 0x80;
+const size_t TAG_SIZE = 2;
+
+bool starts_with_tag(const std::string& s)
+{
+    return !s.empty() && static_cast<uint8_t>(s[0]) == FRAME_TAG;
+}
+
+// after a decode failure, the peer's state is probably not what we think
+const double MISMATCH_OFFER_GAP = 2;
+// unanswered offers back off up to this many intervals
+const int MAX_OFFER_BACKOFF = 32;
+
+const size_t MIN_MATCH = 4;
+
+uint32_t read32(const char* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash4(uint32_t v, int bits) { return (v * 2654435761u) >> (32 - bits); }
+
+// FNV-1a, so both ends can tell whether they hold the same dictionary under an id
+uint32_t content_hash(const std::string& s)
+{
+    uint32_t h = 2166136261u;
+    for (char c : s)
+    {
+        h ^= static_cast<uint8_t>(c);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void put_u32(uint32_t v, std::string* out)
+{
+    for (int i = 0; i < 4; i++) out->push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+uint32_t get_u32(const char* p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+// lengths of 15 and over continue in 255 valued bytes, as in LZ4
+void put_length(size_t len, std::string* out)
+{
+    while (len >= 255)
+    {
+        out->push_back(static_cast<char>(255));
+        len -= 255;
+    }
+    out->push_back(static_cast<char>(len));
+}
+
+bool get_length(const char* in, size_t n, size_t* ip, size_t* len)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip >= n)
+            return false;
+        b = static_cast<uint8_t>(in[(*ip)++]);
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+void put_sequence(const char* literals, size_t num_literals, size_t offset, size_t match_len,
+                  std::string* out)
+{
+    size_t extra_match = match_len - MIN_MATCH;
+    uint8_t token = (std::min<size_t>(num_literals, 15) << 4) |
+                    (offset ? std::min<size_t>(extra_match, 15) : 0);
+    out->push_back(static_cast<char>(token));
+    if (num_literals >= 15)
+        put_length(num_literals - 15, out);
+    out->append(literals, num_literals);
+
+    // the last sequence is literals only
+    if (!offset)
+        return;
+
+    out->push_back(static_cast<char>(offset & 0xff));
+    out->push_back(static_cast<char>(offset >> 8));
+    if (extra_match >= 15)
+        put_length(extra_match - 15, out);
+}
+
+// sequences that split a frame on the line based link, or are trimmed from its end on receive
+bool link_safe(const std::string& s)
+{
+    return s.find("\r\n") == std::string::npos && s.find("+++") == std::string::npos &&
+           (s.empty() || s.back() != '\n');
+}
+} // namespace
+
+namespace goby
+{
+namespace acomms
+{
+
+EvologicsCompression::EvologicsCompression() : table_(1 << HASH_BITS)
+{
+}
+
+bool EvologicsCompression::add_dictionary(int id, const std::string& data)
+{
+    if (id < 1 || id > 127)
+        return false;
+
+    Dictionary& dict = dictionaries_[id];
+    dict.data = data.size() > MAX_WINDOW ? data.substr(data.size() - MAX_WINDOW) : data;
+    dict.hash = content_hash(dict.data);
+
+    dict.table.assign(1 << HASH_BITS, -1);
+    for (size_t i = 0; i + MIN_MATCH <= dict.data.size(); i++)
+        dict.table[hash4(read32(&dict.data[i]), HASH_BITS)] = i;
+
+    // anything already agreed with the peer no longer holds for this id
+    shared_[id] = false;
+    return true;
+}
+
+bool EvologicsCompression::load_dictionary(int id, const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return add_dictionary(id, data);
+}
+
+void EvologicsCompression::reserve(size_t max_frame)
+{
+    max_frame_ = max_frame;
+    window_.reserve(MAX_WINDOW + max_frame);
+    // a frame that does not shrink is abandoned partway, but may overshoot by one sequence
+    candidate_.reserve(2 * max_frame + 16);
+}
+
+size_t EvologicsCompression::reserved_bytes() const
+{
+    return window_.capacity() + candidate_.capacity() + table_.size() * sizeof(int32_t);
+}
+
+bool EvologicsCompression::offer_due(double now) const
+{
+    if (!enabled_ || offers_sent_ == 0)
+        return false;
+
+    if (offer_mismatch_)
+        return now - last_offer_ >= MISMATCH_OFFER_GAP;
+
+    return !peer_has_our_offer_ && now - last_offer_ >= offer_backoff_ * offer_interval_;
+}
+
+void EvologicsCompression::make_offer(std::string* out, double now)
+{
+    if (offers_sent_ > 0 && !peer_has_our_offer_ && !offer_mismatch_)
+        offer_backoff_ = std::min(offer_backoff_ * 2, MAX_OFFER_BACKOFF);
+    offers_sent_++;
+    last_offer_ = now;
+    offer_mismatch_ = false;
+
+    uint8_t flags = (peer_offer_received_ ? OFFER_HAVE_PEER : 0) |
+                    (peer_has_our_offer_ ? 0 : OFFER_NEED_REPLY);
+
+    out->assign(OFFER_MAGIC, OFFER_MAGIC_SIZE);
+    out->push_back(static_cast<char>(OFFER_VERSION));
+    out->push_back(static_cast<char>(flags));
+    out->push_back(static_cast<char>(dictionaries_.size()));
+    for (const auto& d : dictionaries_)
+    {
+        out->push_back(static_cast<char>(d.first));
+        put_u32(d.second.hash, out);
+    }
+}
+
+void EvologicsCompression::encode(const std::string& in, std::string* out)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    bool compressed = false;
+    if (starts_with_tag(in))
+    {
+        out->assign(1, static_cast<char>(FRAME_TAG));
+        out->push_back(static_cast<char>(TAG_RAW));
+        out->append(in);
+    }
+    else
+    {
+        out->assign(in);
+    }
+
+    // only once the peer has confirmed it holds our offer, so it knows which dictionaries we mean
+    if (enabled_ && negotiated())
+    {
+        // no dictionary, then every dictionary the peer also holds; keep the smallest
+        for (int id = 0; id < static_cast<int>(shared_.size()); id++)
+        {
+            if (id != 0 && !shared_[id])
+                continue;
+
+            if (compress(id, in, &candidate_) && candidate_.size() + TAG_SIZE < out->size() &&
+                link_safe(candidate_))
+            {
+                out->assign(1, static_cast<char>(FRAME_TAG));
+                out->push_back(static_cast<char>(TAG_COMPRESSED | id));
+                out->append(candidate_);
+                compressed = true;
+            }
+        }
+    }
+
+    compressed ? stats_.frames_compressed++ : stats_.frames_raw++;
+    stats_.bytes_in += in.size();
+    stats_.bytes_out += out->size();
+    stats_.compress_seconds +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+EvologicsCompression::Frame EvologicsCompression::decode(const std::string& in, std::string* out,
+                                                         bool* send_offer)
+{
+    *send_offer = false;
+
+    // offers are recognised in every state, the peer may have restarted
+    if (in.size() >= OFFER_HEADER_SIZE && in.compare(0, OFFER_MAGIC_SIZE, OFFER_MAGIC) == 0 &&
+        static_cast<uint8_t>(in[OFFER_MAGIC_SIZE]) == OFFER_VERSION)
+    {
+        uint8_t flags = in[OFFER_MAGIC_SIZE + 1];
+        size_t count = static_cast<uint8_t>(in[OFFER_MAGIC_SIZE + 2]);
+        if (in.size() != OFFER_HEADER_SIZE + count * OFFER_ENTRY_SIZE)
+        {
+            stats_.decode_failures++;
+            return Frame::INVALID;
+        }
+
+        // not ours to answer, but still not data
+        if (!enabled_)
+            return Frame::OFFER;
+
+        shared_.fill(false);
+        for (size_t i = 0; i < count; i++)
+        {
+            const char* entry = &in[OFFER_HEADER_SIZE + i * OFFER_ENTRY_SIZE];
+            int id = static_cast<uint8_t>(entry[0]);
+            auto it = dictionaries_.find(id);
+            if (it != dictionaries_.end() && it->second.hash == get_u32(entry + 1))
+                shared_[id] = true;
+        }
+
+        peer_offer_received_ = true;
+        // false again if the peer restarted, so we stop compressing until it has our offer
+        peer_has_our_offer_ = flags & OFFER_HAVE_PEER;
+        if (peer_has_our_offer_)
+            offer_backoff_ = 1;
+
+        *send_offer = flags & OFFER_NEED_REPLY;
+        return Frame::OFFER;
+    }
+
+    // frames say for themselves whether they are compressed, so a lost offer cannot
+    // leave the two ends disagreeing about it
+    if (!starts_with_tag(in) || in.size() < TAG_SIZE)
+    {
+        out->assign(in);
+        return Frame::DATA;
+    }
+
+    uint8_t tag = in[1];
+    if (tag == TAG_RAW)
+    {
+        out->assign(in, TAG_SIZE, std::string::npos);
+        return Frame::DATA;
+    }
+
+    // from a peer that does not escape, handed on untouched
+    if (!(tag & TAG_COMPRESSED))
+    {
+        out->assign(in);
+        return Frame::DATA;
+    }
+
+    int id = tag & ~TAG_COMPRESSED;
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = (id == 0 || shared_[id]) &&
+              decompress(id, in.data() + TAG_SIZE, in.size() - TAG_SIZE, out);
+    stats_.decompress_seconds +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (ok)
+    {
+        stats_.frames_decompressed++;
+        return Frame::DATA;
+    }
+
+    stats_.decode_failures++;
+    offer_mismatch_ = true;
+    return Frame::INVALID;
+}
+
+const std::string& EvologicsCompression::dictionary_data(int id) const
+{
+    static const std::string none;
+    auto it = dictionaries_.find(id);
+    return it == dictionaries_.end() ? none : it->second.data;
+}
+
+bool EvologicsCompression::compress(int id, const std::string& in, std::string* out)
+{
+    const std::string& dict = dictionary_data(id);
+    window_.assign(dict);
+    window_.append(in);
+
+    auto it = dictionaries_.find(id);
+    if (it == dictionaries_.end())
+        std::fill(table_.begin(), table_.end(), -1);
+    else
+        std::copy(it->second.table.begin(), it->second.table.end(), table_.begin());
+
+    out->clear();
+
+    // greedy parse, the match candidate is the last position with the same hash
+    const char* w = window_.data();
+    size_t end = window_.size();
+    size_t anchor = dict.size();
+    size_t i = anchor;
+    while (i + MIN_MATCH <= end)
+    {
+        uint32_t h = hash4(read32(w + i), HASH_BITS);
+        int32_t candidate = table_[h];
+        table_[h] = i;
+
+        if (candidate < 0 || i - candidate > MAX_WINDOW || read32(w + candidate) != read32(w + i))
+        {
+            i++;
+            continue;
+        }
+
+        size_t len = MIN_MATCH;
+        while (i + len < end && w[candidate + len] == w[i + len]) len++;
+
+        put_sequence(w + anchor, i - anchor, i - candidate, len, out);
+        i += len;
+        anchor = i;
+
+        if (out->size() >= in.size())
+            return false;
+    }
+
+    put_sequence(w + anchor, end - anchor, 0, MIN_MATCH, out);
+
+    // a trailing newline is trimmed on receive, so close with a zero offset instead
+    if (!out->empty() && out->back() == '\n')
+        out->append(2, '\0');
+
+    return out->size() < in.size();
+}
+
+bool EvologicsCompression::decompress(int id, const char* in, size_t n, std::string* out)
+{
+    const std::string& dict = dictionary_data(id);
+    window_.assign(dict);
+    size_t base = dict.size();
+
+    size_t ip = 0;
+    while (ip < n)
+    {
+        uint8_t token = in[ip++];
+
+        size_t num_literals = token >> 4;
+        if (num_literals == 15 && !get_length(in, n, &ip, &num_literals))
+            return false;
+        if (num_literals > n - ip || window_.size() - base + num_literals > max_frame_)
+            return false;
+        window_.append(in + ip, num_literals);
+        ip += num_literals;
+
+        if (ip == n)
+            break;
+
+        if (n - ip < 2)
+            return false;
+        size_t offset = static_cast<uint8_t>(in[ip]) | static_cast<uint8_t>(in[ip + 1]) << 8;
+        ip += 2;
+
+        // explicit end of frame
+        if (offset == 0 && ip == n)
+            break;
+
+        size_t match_len = token & 0x0f;
+        if (match_len == 15 && !get_length(in, n, &ip, &match_len))
+            return false;
+        match_len += MIN_MATCH;
+
+        if (offset == 0 || offset > window_.size() || window_.size() - base + match_len > max_frame_)
+            return false;
+
+        // byte at a time, matches may overlap what they produce
+        size_t from = window_.size() - offset;
+        for (size_t k = 0; k < match_len; k++) window_.push_back(window_[from + k]);
+    }
+
+    out->assign(window_, base, std::string::npos);
+    return true;
+}
+
+} // namespace acomms
+} // namespace goby
@@ -0,0 +1,147 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_COMPRESSION_H
+#define GOBY_ACOMMS_MODEMDRIVER_EVO_COMPRESSION_H
+
+#include <array>   // for array
+#include <cstddef> // for size_t
+#include <cstdint> // for uint32_t, uint64_t
+#include <map>     // for map
+#include <string>  // for string
+#include <vector>  // for vector
+
+namespace goby
+{
+namespace acomms
+{
+/// \class EvologicsCompression evologics_compression.h
+/// \brief Optional, negotiated compression of data frames.
+///
+/// A small LZ77 coder (LZ4 style sequences, 64 kB window) that can be primed with
+/// preset dictionaries, e.g. a file of typical telemetry. Both ends exchange offer
+/// frames listing their dictionaries. An offer says whether its sender has the peer's
+/// offer, and asks for a reply until it knows the peer has its own. Frames are only
+/// compressed once the peer's offer confirms it has ours; unanswered offers are resent
+/// with backoff (see offer_due()), sooner after a frame fails to decode.
+///
+/// A compressed frame starts with 0x1b, 0x80 | id (id 0 is no dictionary). Every other
+/// frame goes out as it is, unless it starts with 0x1b, in which case it is escaped
+/// behind 0x1b, 0x00; an application frame never looks like an offer. The receiver needs no negotiation state to tell them apart, so a
+/// lost offer never corrupts data, and a peer without compression understands everything
+/// but offers and escaped frames. encode() and decode() escape frames even while compression
+/// is disabled, so other frames that start with 0x1b (offers, bulk transfer frames) are told
+/// apart from application data on the wire. Assumes a single peer on the link.
+class EvologicsCompression
+{
+  public:
+    struct Stats
+    {
+        uint64_t frames_compressed{0};
+        uint64_t frames_raw{0};
+        uint64_t frames_decompressed{0};
+        uint64_t decode_failures{0};
+        // payload bytes given to encode() and bytes it put on the wire
+        uint64_t bytes_in{0};
+        uint64_t bytes_out{0};
+        double compress_seconds{0};
+        double decompress_seconds{0};
+
+        double ratio() const { return bytes_out ? static_cast<double>(bytes_in) / bytes_out : 1; }
+    };
+
+    /// \brief What decode() found in a received frame.
+    enum class Frame
+    {
+        DATA,
+        OFFER,
+        INVALID
+    };
+
+    EvologicsCompression();
+
+    void set_enabled(bool enabled) { enabled_ = enabled; }
+    bool enabled() const { return enabled_; }
+
+    /// \brief True once the peer has confirmed it has our offer, so frames to it are compressed.
+    bool negotiated() const { return peer_offer_received_ && peer_has_our_offer_; }
+
+    /// \brief Seconds before an unanswered offer is resent, doubled for every further one.
+    void set_offer_interval(double seconds) { offer_interval_ = seconds; }
+
+    /// \brief True when the last offer went unanswered for too long, or a frame from the
+    /// peer failed to decode. now is on the clock given to make_offer().
+    bool offer_due(double now) const;
+
+    /// \brief Add a preset dictionary (ids 1 to 127). Only the last 64 kB is used.
+    bool add_dictionary(int id, const std::string& data);
+
+    /// \brief Read a preset dictionary from a file.
+    bool load_dictionary(int id, const std::string& path);
+
+    /// \brief Preallocate so frames up to max_frame bytes are coded without touching the heap.
+    /// Frames that would decompress to more than max_frame are rejected.
+    void reserve(size_t max_frame);
+
+    /// \brief Bytes preallocated by reserve().
+    size_t reserved_bytes() const;
+
+    /// \brief Build the offer frame listing our dictionaries, sent at time now (seconds,
+    /// any monotonic clock).
+    void make_offer(std::string* out, double now);
+
+    /// \brief Prepare a data frame for the wire.
+    void encode(const std::string& in, std::string* out);
+
+    /// \brief Undo encode() on a received frame.
+    /// \param send_offer Set when the frame was an offer that asks for ours in return.
+    Frame decode(const std::string& in, std::string* out, bool* send_offer);
+
+    const Stats& stats() const { return stats_; }
+
+  private:
+    static constexpr int HASH_BITS = 12;
+    static constexpr size_t MAX_WINDOW = 65535;
+
+    struct Dictionary
+    {
+        std::string data;
+        uint32_t hash;
+        // position of the last occurrence of each hashed 4 byte sequence
+        std::vector<int32_t> table;
+    };
+
+    const std::string& dictionary_data(int id) const;
+    bool compress(int id, const std::string& in, std::string* out);
+    bool decompress(int id, const char* in, size_t n, std::string* out);
+
+    bool enabled_{false};
+    // we have the peer's offer, so we know which dictionaries it holds
+    bool peer_offer_received_{false};
+    // the peer's offer says it has ours
+    bool peer_has_our_offer_{false};
+    // a frame from the peer failed to decode
+    bool offer_mismatch_{false};
+    uint64_t offers_sent_{0};
+    double last_offer_{0};
+    double offer_interval_{30};
+    int offer_backoff_{1};
+    std::array<bool, 128> shared_{};
+
+    std::map<int, Dictionary> dictionaries_;
+    size_t max_frame_{MAX_WINDOW};
+
+    // dictionary followed by the frame, and the hash table for it
+    std::string window_;
+    std::vector<int32_t> table_;
+    std::string candidate_;
+
+    Stats stats_;
+};
+} // namespace acomms
+} // namespace goby
+#endif
@@ -0,0 +1,283 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <cstdlib> // for strtod, strtof, strtol
+
+#include "evologics_protocol.h"
+
+namespace
+{
+// non-throwing field conversions for the notification parsers
+bool parse_field(const std::string& s, double* v)
+{
+    char* end = nullptr;
+    *v = std::strtod(s.c_str(), &end);
+    return end != s.c_str() && *end == '\0';
+}
+
+bool parse_field(const std::string& s, float* v)
+{
+    char* end = nullptr;
+    *v = std::strtof(s.c_str(), &end);
+    return end != s.c_str() && *end == '\0';
+}
+
+bool parse_field(const std::string& s, int* v)
+{
+    char* end = nullptr;
+    *v = std::strtol(s.c_str(), &end, 10);
+    return end != s.c_str() && *end == '\0';
+}
+
+bool parse_field(const std::string& s, bool* v)
+{
+    int i = 0;
+    bool ok = parse_field(s, &i);
+    *v = i;
+    return ok;
+}
+} // namespace
+
+namespace goby
+{
+namespace acomms
+{
+
+EvologicsProtocol::EvologicsProtocol()
+{
+    encoder_.set_transmit_callback([this](const std::string& command) {
+        if (command_callback_)
+        {
+            command_callback_(command);
+        }
+    });
+
+    decoder_.set_decode_callback(
+        std::bind(&EvologicsProtocol::on_decode, this, std::placeholders::_1));
+}
+
+void EvologicsProtocol::reserve(size_t max_line, size_t max_fields)
+{
+    buffer_.reserve(max_line);
+    max_fields_ = max_fields;
+    encoder_.reserve(max_line);
+    decoder_.reserve(max_line, max_fields);
+}
+
+size_t EvologicsProtocol::reserved_bytes() const
+{
+    // encoder and decoder buffers match buffer_, as does every decoded field
+    return (3 + max_fields_) * buffer_.capacity() + max_fields_ * sizeof(std::string);
+}
+
+void EvologicsProtocol::process_line(std::string& line, double host_time)
+{
+    rx_host_time_ = host_time;
+
+    // strip the delimiter
+    line.resize(line.size() < 2 ? 0 : line.size() - 2);
+
+    size_t split_index = line.find("+++");
+
+    //it is for sure an AT message
+    if(split_index == 0)
+    {
+        rx_line_ = line;
+        record_decode_status(decoder_.decode(line), line);
+    }
+    //this is some combo binary then AT
+    else if(split_index != std::string::npos)
+    {
+        buffer_.append(line, 0, split_index);
+        std::string_view at_str = std::string_view(line).substr(split_index);
+        rx_line_ = at_str;
+        record_decode_status(decoder_.decode(at_str), at_str);
+    }
+    else
+    {
+        buffer_.append(line);
+
+        if (data_callback_)
+        {
+            data_callback_(buffer_);
+        }
+        buffer_.clear();
+    }
+}
+
+void EvologicsProtocol::frame_command(const std::string& command, std::string* out) const
+{
+    out->assign(command);
+    out->append(link_ == Link::SERIAL ? "\r" : "\n");
+}
+
+void EvologicsProtocol::frame_data(const std::string& data, std::string* out) const
+{
+    out->assign(data);
+    out->append("\r\n");
+}
+
+hayes::AtStatus EvologicsProtocol::on_decode(const hayes::AtMsg& msg)
+{
+
+    if(msg.command == "USBLLONG")
+    {
+        if (msg.fields < 16)
+            return hayes::AtStatus::TOO_FEW_FIELDS;
+
+        UsbllongMsg usbl;
+
+        bool ok = parse_field(msg.data[0], &usbl.current_time) &&
+                  parse_field(msg.data[1], &usbl.measurement_time) &&
+                  parse_field(msg.data[2], &usbl.remote_address) &&
+                  parse_field(msg.data[3], &usbl.xyz.x) &&
+                  parse_field(msg.data[4], &usbl.xyz.y) &&
+                  parse_field(msg.data[5], &usbl.xyz.z) &&
+                  parse_field(msg.data[6], &usbl.enu.e) &&
+                  parse_field(msg.data[7], &usbl.enu.n) &&
+                  parse_field(msg.data[8], &usbl.enu.u) &&
+                  parse_field(msg.data[9], &usbl.rpy.roll) &&
+                  parse_field(msg.data[10], &usbl.rpy.pitch) &&
+                  parse_field(msg.data[11], &usbl.rpy.yaw) &&
+                  parse_field(msg.data[12], &usbl.propogation_time) &&
+                  parse_field(msg.data[13], &usbl.rssi) &&
+                  parse_field(msg.data[14], &usbl.integrity) &&
+                  parse_field(msg.data[15], &usbl.accuracy);
+        if (!ok)
+            return hayes::AtStatus::BAD_FIELD;
+
+        sync_clock(usbl.current_time, usbl.measurement_time, &usbl.host_measurement_time);
+
+        if(usbl_callback_)
+        {
+            usbl_callback_(usbl);
+        }
+    }
+    else if(msg.command == "SENDSTART")
+    {
+        if(transmit_callback_)
+        {
+            transmit_callback_(true);
+        }
+    }
+    else if(msg.command == "SENDEND")
+    {
+        if(transmit_callback_)
+        {
+            transmit_callback_(false);
+        }
+    }
+    else if(msg.command == "USBLANGLES")
+    {
+        if (msg.fields < 13)
+            return hayes::AtStatus::TOO_FEW_FIELDS;
+
+        UsblAnglesMsg angles;
+        bool ok = parse_field(msg.data[0], &angles.current_time) &&
+                  parse_field(msg.data[1], &angles.measurement_time) &&
+                  parse_field(msg.data[2], &angles.remote_address) &&
+                  parse_field(msg.data[3], &angles.local_bearing) &&
+                  parse_field(msg.data[4], &angles.local_elevation) &&
+                  parse_field(msg.data[5], &angles.bearing) &&
+                  parse_field(msg.data[6], &angles.elevation) &&
+                  parse_field(msg.data[7], &angles.roll) &&
+                  parse_field(msg.data[8], &angles.pitch) &&
+                  parse_field(msg.data[9], &angles.yaw) &&
+                  parse_field(msg.data[10], &angles.rssi) &&
+                  parse_field(msg.data[11], &angles.integrity) &&
+                  parse_field(msg.data[12], &angles.accuracy);
+        if (!ok)
+            return hayes::AtStatus::BAD_FIELD;
+
+        sync_clock(angles.current_time, angles.measurement_time, &angles.host_measurement_time);
+
+        if(angles_callback_)
+        {
+            angles_callback_(angles);
+        }
+    }
+    else if(msg.command == "USBLPHYD")
+    {
+        if (msg.fields < 12)
+            return hayes::AtStatus::TOO_FEW_FIELDS;
+
+        UsblPhydMsg phyd;
+        bool ok = parse_field(msg.data[0], &phyd.current_time) &&
+                  parse_field(msg.data[1], &phyd.measurement_time) &&
+                  parse_field(msg.data[2], &phyd.remote_address) &&
+                  parse_field(msg.data[3], &phyd.fix_type) &&
+                  parse_field(msg.data[4], &phyd.delay_1_5) &&
+                  parse_field(msg.data[5], &phyd.delay_2_5) &&
+                  parse_field(msg.data[6], &phyd.delay_3_5) &&
+                  parse_field(msg.data[7], &phyd.delay_4_5) &&
+                  parse_field(msg.data[8], &phyd.delay_1_2) &&
+                  parse_field(msg.data[9], &phyd.delay_4_1) &&
+                  parse_field(msg.data[10], &phyd.delay_3_2) &&
+                  parse_field(msg.data[11], &phyd.delay_3_4);
+        if (!ok)
+            return hayes::AtStatus::BAD_FIELD;
+
+        sync_clock(phyd.current_time, phyd.measurement_time, &phyd.host_measurement_time);
+
+        if(phyd_callback_)
+        {
+            phyd_callback_(phyd);
+        }
+    }
+    else if(msg.command == "DELIVEREDIM" || msg.command == "FAILEDIM")
+    {
+        if (msg.fields < 1)
+            return hayes::AtStatus::TOO_FEW_FIELDS;
+
+        int remote_address = 0;
+        if (!parse_field(msg.data[0], &remote_address))
+            return hayes::AtStatus::BAD_FIELD;
+
+        if(instant_message_callback_)
+        {
+            instant_message_callback_(remote_address, msg.command == "DELIVEREDIM");
+        }
+    }
+    else if(msg.command.compare(0, 5, "+++AT") == 0)
+    {
+        if (reply_callback_)
+        {
+            reply_callback_(msg.command);
+        }
+        return hayes::AtStatus::OK;
+    }
+
+    if (notification_callback_)
+    {
+        notification_callback_(msg.command, rx_line_);
+    }
+
+    return hayes::AtStatus::OK;
+}
+
+void EvologicsProtocol::sync_clock(double current_time, double measurement_time,
+                                   double* host_measurement_time)
+{
+    clock_.add_sample(current_time, rx_host_time_);
+    *host_measurement_time = clock_.to_host(measurement_time);
+}
+
+void EvologicsProtocol::record_decode_status(hayes::AtStatus status, std::string_view raw)
+{
+    if (status == hayes::AtStatus::OK)
+        return;
+
+    decode_errors_[static_cast<size_t>(status)]++;
+
+    if (decode_error_callback_)
+    {
+        decode_error_callback_(status, raw);
+    }
+}
+
+} // namespace acomms
+} // namespace goby
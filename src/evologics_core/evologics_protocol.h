@@ -0,0 +1,211 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_PROTOCOL_H
+#define GOBY_ACOMMS_MODEMDRIVER_EVO_PROTOCOL_H
+
+#include <array>      // for array
+#include <cstdint>    // for uint64_t
+#include <functional> // for function
+#include <string>     // for string
+#include <string_view> // for string_view
+
+#include "HayesAtDecoder.h"
+#include "HayesAtEncoder.h"
+#include "evologics_clock.h"
+
+namespace goby
+{
+namespace acomms
+{
+/// \class EvologicsProtocol evologics_protocol.h
+/// \brief Evologics line framing, notification parsing and command building, without goby.
+///
+/// Knows nothing about the physical link: lines read from the modem go in through
+/// process_line() and everything that comes out is delivered through callbacks.
+/// Does not throw, so it can be built with -fno-exceptions.
+class EvologicsProtocol
+{
+  public:
+    struct XYZ
+    {
+        float x;
+        float y;
+        float z;
+    };
+
+    struct ENU
+    {
+        float e;
+        float n;
+        float u;
+    };
+
+    struct RPY
+    {
+        float roll;
+        float pitch;
+        float yaw;
+    };
+
+    struct UsbllongMsg
+    {
+        double current_time;
+        double measurement_time;
+        int remote_address;
+        XYZ xyz;
+        ENU enu;
+        RPY rpy;
+        float propogation_time;
+        int rssi;
+        int integrity;
+        float accuracy;
+        // measurement_time converted to host time (seconds since the epoch)
+        double host_measurement_time;
+    };
+
+    struct UsblAnglesMsg
+    {
+        double current_time;
+        double measurement_time;
+        int remote_address;
+        float local_bearing;
+        float local_elevation;
+        float bearing;
+        float elevation;
+        float roll;
+        float pitch;
+        float yaw;
+        float rssi;
+        float integrity;
+        float accuracy;
+        double host_measurement_time;
+    };
+
+    struct UsblPhydMsg
+    {
+        double current_time;
+        double measurement_time;
+        int remote_address;
+        bool fix_type;
+        int delay_1_5;
+        int delay_2_5;
+        int delay_3_5;
+        int delay_4_5;
+        int delay_1_2;
+        int delay_4_1;
+        int delay_3_2;
+        int delay_3_4;
+        double host_measurement_time;
+    };
+
+    /// \brief Physical link, which decides how outgoing lines are terminated.
+    enum class Link
+    {
+        SERIAL,
+        TCP
+    };
+
+    typedef std::function<void(const UsbllongMsg&)> UsblCallback;
+    typedef std::function<void(const UsblAnglesMsg&)> AnglesCallback;
+    typedef std::function<void(const UsblPhydMsg&)> PhydCallback;
+    typedef std::function<void(bool)> TransmitCallback;
+    // DELIVEREDIM / FAILEDIM for an instant message sent with ack, (remote address, delivered)
+    typedef std::function<void(int, bool)> InstantMessageCallback;
+    // replies to our own commands, e.g. "+++AT?L:1:3"
+    typedef std::function<void(const std::string&)> ReplyCallback;
+    // a received data frame
+    typedef std::function<void(std::string&)> DataCallback;
+    // an encoded AT command, not yet terminated
+    typedef std::function<void(const std::string&)> CommandCallback;
+    // the line is only valid for the call, so malformed input costs no allocation
+    typedef std::function<void(hayes::AtStatus, std::string_view)> DecodeErrorCallback;
+    // every notification that decoded cleanly, by name, with the line as received
+    typedef std::function<void(const std::string&, std::string_view)> NotificationCallback;
+
+    EvologicsProtocol();
+
+    void set_link(Link link) { link_ = link; }
+
+    /// \brief Preallocate every buffer so lines and commands up to max_line bytes,
+    /// with up to max_fields fields, are handled without touching the heap.
+    void reserve(size_t max_line, size_t max_fields);
+
+    /// \brief Bytes preallocated by reserve().
+    size_t reserved_bytes() const;
+
+    /// \brief Handle one line read from the modem, with its delimiter still attached.
+    /// \param host_time Host time (seconds) the line was read, used for the clock model.
+    void process_line(std::string& line, double host_time);
+
+    /// \brief Dispatch one decoded AT line.
+    hayes::AtStatus on_decode(const hayes::AtMsg& msg);
+
+    /// \brief Build an AT command and pass it to the command callback.
+    void encode(const hayes::AtMsg& msg) { encoder_.encode(msg); }
+
+    /// \brief Terminate an encoded command for the current link, into out (whose capacity is reused).
+    void frame_command(const std::string& command, std::string* out) const;
+
+    /// \brief Terminate a data frame for the current link, into out (whose capacity is reused).
+    void frame_data(const std::string& data, std::string* out) const;
+
+    /// \brief Modem to host clock model, fed from the timestamps in every USBL notification.
+    const EvologicsClock& clock() const { return clock_; }
+
+    /// \brief Number of lines that failed to decode with the given status since construction.
+    uint64_t decode_error_count(hayes::AtStatus status) const
+    {
+        return decode_errors_[static_cast<size_t>(status)];
+    }
+
+    void set_usbl_callback(UsblCallback c) { usbl_callback_ = c; }
+    void set_angles_callback(AnglesCallback c) { angles_callback_ = c; }
+    void set_phyd_callback(PhydCallback c) { phyd_callback_ = c; }
+    void set_transmit_callback(TransmitCallback c) { transmit_callback_ = c; }
+    void set_instant_message_callback(InstantMessageCallback c) { instant_message_callback_ = c; }
+    void set_reply_callback(ReplyCallback c) { reply_callback_ = c; }
+    void set_data_callback(DataCallback c) { data_callback_ = c; }
+    void set_command_callback(CommandCallback c) { command_callback_ = c; }
+    void set_decode_error_callback(DecodeErrorCallback c) { decode_error_callback_ = c; }
+    void set_notification_callback(NotificationCallback c) { notification_callback_ = c; }
+
+  private:
+    void sync_clock(double current_time, double measurement_time, double* host_measurement_time);
+    void record_decode_status(hayes::AtStatus status, std::string_view raw);
+
+    Link link_{Link::SERIAL};
+
+    hayes::AtEncoder encoder_;
+    hayes::AtDecoder decoder_;
+
+    // binary data waiting for the end of its frame
+    std::string buffer_;
+    size_t max_fields_{0};
+
+    // host time the line being decoded was read, paired with the modem's current_time
+    double rx_host_time_{0};
+    // the AT line being decoded
+    std::string_view rx_line_;
+    EvologicsClock clock_;
+
+    std::array<uint64_t, static_cast<size_t>(hayes::AtStatus::COUNT)> decode_errors_{};
+
+    UsblCallback usbl_callback_;
+    AnglesCallback angles_callback_;
+    PhydCallback phyd_callback_;
+    TransmitCallback transmit_callback_;
+    InstantMessageCallback instant_message_callback_;
+    ReplyCallback reply_callback_;
+    DataCallback data_callback_;
+    CommandCallback command_callback_;
+    DecodeErrorCallback decode_error_callback_;
+    NotificationCallback notification_callback_;
+};
+} // namespace acomms
+} // namespace goby
+#endif
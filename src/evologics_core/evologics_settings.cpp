@@ -0,0 +1,237 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <cctype>  // for isdigit
+#include <fstream> // for ifstream, ofstream
+#include <sstream> // for istringstream
+
+#include "evologics_settings.h"
+
+namespace
+{
+struct SettingInfo
+{
+    std::string set;
+    std::string query;
+    std::string name;
+};
+
+// indexed by EvologicsSetting
+const std::array<SettingInfo, static_cast<size_t>(goby::acomms::EvologicsSetting::COUNT)> SETTINGS = {{
+    {"!L", "?L", "source_level"},
+    {"!LC", "?LC", "source_control"},
+    {"!G", "?G", "gain"},
+    {"!C", "?C", "carrier_waveform_id"},
+    {"!AL", "?AL", "local_address"},
+    {"!AR", "?AR", "remote_address"},
+    {"!AM", "?AM", "highest_address"},
+    {"!ZC", "?ZC", "cluster_size"},
+    {"!ZP", "?ZP", "packet_time"},
+    {"!RC", "?RC", "retry_count"},
+    {"!RT", "?RT", "retry_timeout"},
+    {"!KO", "?KO", "keep_online_count"},
+    {"!ZI", "?ZI", "idle_timeout"},
+    {"!ZS", "?ZS", "channel_protocol_id"},
+    {"!CA", "?CA", "sound_speed"},
+}};
+
+const SettingInfo& info(goby::acomms::EvologicsSetting s) { return SETTINGS[static_cast<size_t>(s)]; }
+} // namespace
+
+namespace goby
+{
+namespace acomms
+{
+
+EvologicsSettings::EvologicsSettings()
+{
+}
+
+const std::string& EvologicsSettings::set_command(EvologicsSetting s) { return info(s).set; }
+
+const std::string& EvologicsSettings::query_command(EvologicsSetting s) { return info(s).query; }
+
+const std::string& EvologicsSettings::name(EvologicsSetting s) { return info(s).name; }
+
+const std::vector<EvologicsSetting>& EvologicsSettings::all()
+{
+    static const std::vector<EvologicsSetting> settings = [] {
+        std::vector<EvologicsSetting> v;
+        for (size_t i = 0; i < static_cast<size_t>(EvologicsSetting::COUNT); i++)
+            v.push_back(static_cast<EvologicsSetting>(i));
+        return v;
+    }();
+    return settings;
+}
+
+bool EvologicsSettings::from_name(const std::string& setting_name, EvologicsSetting* s)
+{
+    for (EvologicsSetting candidate : all())
+    {
+        if (name(candidate) == setting_name)
+        {
+            *s = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EvologicsSettings::from_command(const std::string& command, EvologicsSetting* s)
+{
+    if (command.empty())
+        return false;
+
+    // "!L" and "!LC" share a prefix, so take the longest match
+    size_t best = 0;
+    for (EvologicsSetting candidate : all())
+    {
+        const std::string& prefix =
+            command[0] == '?' ? query_command(candidate) : set_command(candidate);
+
+        if (prefix.size() <= best || command.compare(0, prefix.size(), prefix) != 0)
+            continue;
+
+        // a write must be followed by the value only, a query by nothing
+        bool rest_ok = true;
+        for (size_t i = prefix.size(); i < command.size(); i++)
+        {
+            if (command[0] == '?' || !(isdigit(command[i]) || (i == prefix.size() && command[i] == '-')))
+                rest_ok = false;
+        }
+
+        if (rest_ok)
+        {
+            best = prefix.size();
+            *s = candidate;
+        }
+    }
+    return best > 0;
+}
+
+bool EvologicsSettings::value(EvologicsSetting s, int* v) const
+{
+    const Entry& e = entry(s);
+    if (!e.known)
+        return false;
+    *v = e.value;
+    return true;
+}
+
+void EvologicsSettings::set_value(EvologicsSetting s, int v)
+{
+    Entry& e = entry(s);
+    e.known = true;
+    e.value = v;
+}
+
+void EvologicsSettings::invalidate(EvologicsSetting s)
+{
+    Entry& e = entry(s);
+    e.known = false;
+}
+
+void EvologicsSettings::invalidate_all()
+{
+    for (EvologicsSetting s : all()) invalidate(s);
+}
+
+bool EvologicsSettings::desired(EvologicsSetting s, int* v) const
+{
+    const Entry& e = entry(s);
+    if (!e.has_desired)
+        return false;
+    *v = e.desired;
+    return true;
+}
+
+void EvologicsSettings::set_desired(EvologicsSetting s, int v)
+{
+    Entry& e = entry(s);
+    e.has_desired = true;
+    e.desired = v;
+}
+
+void EvologicsSettings::set_desired(const EvologicsSettingsProfile& profile)
+{
+    for (const auto& p : profile) set_desired(p.first, p.second);
+}
+
+void EvologicsSettings::set_read_pending(EvologicsSetting s, bool pending)
+{
+    entry(s).read_pending = pending;
+}
+
+bool EvologicsSettings::read_pending(EvologicsSetting s) const { return entry(s).read_pending; }
+
+bool EvologicsSettings::reads_outstanding() const
+{
+    for (const Entry& e : entries_)
+    {
+        if (e.read_pending)
+            return true;
+    }
+    return false;
+}
+
+bool EvologicsSettings::writes_held() const
+{
+    for (const Entry& e : entries_)
+    {
+        if (e.has_desired && e.read_pending)
+            return true;
+    }
+    return false;
+}
+
+bool EvologicsSettings::needs_write(EvologicsSetting s) const
+{
+    const Entry& e = entry(s);
+    if (!e.has_desired || e.read_pending)
+        return false;
+    return !(e.known && e.value == e.desired);
+}
+
+bool EvologicsSettings::load(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in.is_open())
+        return false;
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream ss(line);
+        std::string kind, setting_name;
+        int v;
+        if (!(ss >> kind >> setting_name >> v) || kind != "desired")
+            continue;
+
+        EvologicsSetting s;
+        if (from_name(setting_name, &s))
+            set_desired(s, v);
+    }
+    return true;
+}
+
+bool EvologicsSettings::save(const std::string& path) const
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out.is_open())
+        return false;
+
+    for (EvologicsSetting s : all())
+    {
+        const Entry& e = entry(s);
+        if (e.has_desired)
+            out << "desired " << name(s) << " " << e.desired << "\n";
+    }
+    return out.good();
+}
+
+} // namespace acomms
+} // namespace goby
@@ -0,0 +1,112 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_SETTINGS_H
+#define GOBY_ACOMMS_MODEMDRIVER_EVO_SETTINGS_H
+
+#include <array>  // for array
+#include <map>    // for map
+#include <string> // for string
+#include <vector> // for vector
+
+namespace goby
+{
+namespace acomms
+{
+/// \brief Integer device settings the driver knows how to read and write.
+enum class EvologicsSetting
+{
+    SOURCE_LEVEL,
+    SOURCE_CONTROL,
+    GAIN,
+    CARRIER_WAVEFORM_ID,
+    LOCAL_ADDRESS,
+    REMOTE_ADDRESS,
+    HIGHEST_ADDRESS,
+    CLUSTER_SIZE,
+    PACKET_TIME,
+    RETRY_COUNT,
+    RETRY_TIMEOUT,
+    KEEP_ONLINE_COUNT,
+    IDLE_TIMEOUT,
+    CHANNEL_PROTOCOL_ID,
+    SOUND_SPEED,
+    COUNT
+};
+
+/// \brief Desired state for a set of device settings.
+typedef std::map<EvologicsSetting, int> EvologicsSettingsProfile;
+
+/// \class EvologicsSettings evologics_settings.h
+/// \brief Model of the modem's settings, used to avoid sending commands that would not change anything.
+///
+/// Each setting tracks the last value known to be on the device, the value the
+/// application wants, and whether a read of that setting is still outstanding.
+class EvologicsSettings
+{
+  public:
+    EvologicsSettings();
+
+    /// \brief AT command used to write a setting, e.g. "!L" (value is appended).
+    static const std::string& set_command(EvologicsSetting s);
+
+    /// \brief AT command used to read a setting, e.g. "?L".
+    static const std::string& query_command(EvologicsSetting s);
+
+    /// \brief Name used in the cache file, e.g. "source_level".
+    static const std::string& name(EvologicsSetting s);
+
+    static const std::vector<EvologicsSetting>& all();
+
+    /// \brief Find a setting by the name returned by name().
+    static bool from_name(const std::string& setting_name, EvologicsSetting* s);
+
+    /// \brief Find the setting addressed by a query ("?L") or write ("!L3") command.
+    static bool from_command(const std::string& command, EvologicsSetting* s);
+
+    /// \brief Last value read from or written to the device.
+    bool value(EvologicsSetting s, int* v) const;
+    void set_value(EvologicsSetting s, int v);
+    void invalidate(EvologicsSetting s);
+    void invalidate_all();
+
+    bool desired(EvologicsSetting s, int* v) const;
+    void set_desired(EvologicsSetting s, int v);
+    void set_desired(const EvologicsSettingsProfile& profile);
+
+    void set_read_pending(EvologicsSetting s, bool pending);
+    bool read_pending(EvologicsSetting s) const;
+    bool reads_outstanding() const;
+    /// \brief True while a desired value waits on a read to tell whether it must be written.
+    bool writes_held() const;
+
+    /// \brief True if the desired value differs from what is known to be on the device.
+    bool needs_write(EvologicsSetting s) const;
+
+    /// \brief Load the desired values from a cache file written by save(). What is on the
+    /// device is not cached, it is only known once read back or written.
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+  private:
+    struct Entry
+    {
+        bool known{false};
+        bool read_pending{false};
+        bool has_desired{false};
+        int value{0};
+        int desired{0};
+    };
+
+    Entry& entry(EvologicsSetting s) { return entries_[static_cast<size_t>(s)]; }
+    const Entry& entry(EvologicsSetting s) const { return entries_[static_cast<size_t>(s)]; }
+
+    std::array<Entry, static_cast<size_t>(EvologicsSetting::COUNT)> entries_;
+};
+} // namespace acomms
+} // namespace goby
+#endif
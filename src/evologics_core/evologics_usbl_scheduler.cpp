@@ -0,0 +1,166 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <algorithm> // for min
+
+#include "evologics_usbl_scheduler.h"
+
+namespace goby
+{
+namespace acomms
+{
+
+EvologicsUsblScheduler::EvologicsUsblScheduler()
+{
+}
+
+void EvologicsUsblScheduler::set_targets(const std::vector<int>& addresses, double now)
+{
+    std::vector<Target> targets;
+    for (int address : addresses)
+    {
+        // keep what we already know about targets that stay in the set
+        Target* existing = find(address);
+        if (existing)
+        {
+            targets.push_back(*existing);
+        }
+        else
+        {
+            Target t;
+            t.address = address;
+            t.added = now;
+            targets.push_back(t);
+        }
+    }
+
+    targets_.swap(targets);
+    next_ = 0;
+    awaiting_ = -1;
+}
+
+bool EvologicsUsblScheduler::next_ping(double now, int* address)
+{
+    if (targets_.empty())
+        return false;
+
+    if (awaiting_ >= 0)
+    {
+        if (now < hold_until_)
+            return false;
+        finish_ping(now);
+    }
+
+    for (size_t n = 0; n < targets_.size(); n++)
+    {
+        size_t i = next_;
+        next_ = (next_ + 1) % targets_.size();
+
+        Target& t = targets_[i];
+        if (now < t.skip_until)
+            continue;
+
+        t.pings++;
+        awaiting_ = i;
+        got_fix_ = false;
+        hold_until_ = now + hold_time(t);
+        *address = t.address;
+        return true;
+    }
+    return false;
+}
+
+void EvologicsUsblScheduler::on_fix(int address, double now, double propagation_time)
+{
+    Target* t = find(address);
+    if (!t)
+        return;
+
+    if (propagation_time > 0)
+        t->propagation_time = propagation_time;
+
+    if (awaiting_ >= 0 && targets_[awaiting_].address == address)
+    {
+        got_fix_ = true;
+        // USBLLONG and USBLANGLES arrive together, wait only for the other one
+        hold_until_ = std::min(hold_until_, now + cfg_.guard);
+    }
+}
+
+void EvologicsUsblScheduler::on_reply(int address, bool delivered, double now)
+{
+    if (awaiting_ < 0 || targets_[awaiting_].address != address)
+        return;
+
+    // a failed delivery means no fix is coming; a delivered one means it is imminent
+    hold_until_ = std::min(hold_until_, delivered ? now + cfg_.guard : now);
+}
+
+std::vector<EvologicsUsblScheduler::TargetStats> EvologicsUsblScheduler::stats(double now) const
+{
+    std::vector<TargetStats> stats;
+    for (const Target& t : targets_)
+    {
+        double elapsed = now - t.added;
+        stats.push_back({t.address, t.pings, t.fixes, t.consecutive_misses, t.propagation_time,
+                         elapsed > 0 ? t.fixes / elapsed : 0});
+    }
+    return stats;
+}
+
+EvologicsUsblScheduler::Target* EvologicsUsblScheduler::find(int address)
+{
+    for (Target& t : targets_)
+    {
+        if (t.address == address)
+            return &t;
+    }
+    return nullptr;
+}
+
+double EvologicsUsblScheduler::hold_time(const Target& t) const
+{
+    if (t.propagation_time <= 0)
+        return cfg_.max_round_trip;
+
+    return std::min(cfg_.max_round_trip, 2 * t.propagation_time + cfg_.ping_overhead + cfg_.guard);
+}
+
+double EvologicsUsblScheduler::round_time() const
+{
+    double round = 0;
+    for (const Target& t : targets_) round += hold_time(t);
+    return round;
+}
+
+void EvologicsUsblScheduler::finish_ping(double now)
+{
+    Target& t = targets_[awaiting_];
+    awaiting_ = -1;
+
+    // counted once per ping, USBLLONG and USBLANGLES are the same fix
+    if (got_fix_)
+    {
+        t.fixes++;
+        t.consecutive_misses = 0;
+        return;
+    }
+
+    // a target that keeps missing may have moved out of its old range
+    t.consecutive_misses++;
+    if (t.consecutive_misses >= 3)
+        t.propagation_time = -1;
+
+    // one miss may be noise, after that back off exponentially. Rounds are timed rather
+    // than counted, do_work() calls next_ping() far more often than a round completes.
+    int misses = std::min(t.consecutive_misses, 16);
+    int rounds = std::min((1 << (misses - 1)) - 1, cfg_.max_skip_rounds);
+    t.skip_until = now + rounds * round_time();
+}
+
+} // namespace acomms
+} // namespace goby
@@ -0,0 +1,105 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_USBL_SCHEDULER_H
+#define GOBY_ACOMMS_MODEMDRIVER_EVO_USBL_SCHEDULER_H
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+#include <vector>  // for vector
+
+namespace goby
+{
+namespace acomms
+{
+/// \class EvologicsUsblScheduler evologics_usbl_scheduler.h
+/// \brief Decides which USBL target to interrogate next and when.
+///
+/// Targets are pinged round robin, one at a time. Each ping holds the channel for
+/// the round trip expected from the target's last measured propagation time (or
+/// max_round_trip until it has been ranged), and is released early once the fix or
+/// a failed delivery comes back. Targets that stop answering are skipped for an
+/// exponentially growing number of rounds, timed from the expected length of a round.
+/// All times are in seconds on any monotonic clock.
+class EvologicsUsblScheduler
+{
+  public:
+    struct Config
+    {
+        // channel hold for a target with no known range, covers the longest expected round trip
+        double max_round_trip{4.0};
+        // instant message airtime plus modem turnaround, added to the acoustic round trip
+        double ping_overhead{0.6};
+        // margin after the expected reply, and the wait for the rest of a fix after the first notification
+        double guard{0.2};
+        // cap on the number of rounds a silent target is skipped
+        int max_skip_rounds{8};
+    };
+
+    struct TargetStats
+    {
+        int address;
+        uint64_t pings;
+        uint64_t fixes;
+        int consecutive_misses;
+        // one way, seconds, negative if not ranged yet
+        double propagation_time;
+        // answered pings per second since the target was added
+        double fix_rate;
+    };
+
+    EvologicsUsblScheduler();
+
+    void set_config(const Config& cfg) { cfg_ = cfg; }
+
+    /// \brief Replace the set of targets. An empty set stops interrogation.
+    void set_targets(const std::vector<int>& addresses, double now);
+
+    bool active() const { return !targets_.empty(); }
+
+    /// \brief If the channel is free, pick the target to ping now.
+    bool next_ping(double now, int* address);
+
+    /// \brief A fix arrived for address. propagation_time is one way in seconds, negative if unknown.
+    void on_fix(int address, double now, double propagation_time);
+
+    /// \brief Delivery report for the instant message sent to address.
+    void on_reply(int address, bool delivered, double now);
+
+    std::vector<TargetStats> stats(double now) const;
+
+  private:
+    struct Target
+    {
+        int address;
+        uint64_t pings{0};
+        uint64_t fixes{0};
+        int consecutive_misses{0};
+        // silent targets are not pinged before this
+        double skip_until{0};
+        double propagation_time{-1};
+        double added{0};
+    };
+
+    Target* find(int address);
+    double hold_time(const Target& t) const;
+    // expected length of one round of pings to every target
+    double round_time() const;
+    void finish_ping(double now);
+
+    Config cfg_;
+    std::vector<Target> targets_;
+    size_t next_{0};
+
+    // the ping in flight, if any
+    int awaiting_{-1};
+    bool got_fix_{false};
+    double hold_until_{0};
+};
+} // namespace acomms
+} // namespace goby
+#endif
@@ -0,0 +1,432 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <algorithm>    // for remove_if, all_of
+#include <cctype>       // for isxdigit
+#include <cerrno>       // for errno
+#include <cstring>      // for strncpy
+#include <fcntl.h>      // for fcntl
+#include <iostream>     // for cout
+#include <sstream>      // for istringstream, ostringstream
+#include <sys/socket.h> // for socket, bind, listen, accept, recv, send
+#include <sys/un.h>     // for sockaddr_un
+#include <unistd.h>     // for close, unlink
+
+#include "goby/util/binary.h" // for hex_encode, hex_decode
+
+#include "evologics_broker.h"
+
+using goby::util::hex_decode;
+using goby::util::hex_encode;
+
+namespace
+{
+bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+} // namespace
+
+goby::acomms::EvologicsBroker::EvologicsBroker(EvologicsDriver& driver) : driver_(driver)
+{
+    driver_.set_notification_callback([this](const std::string& name, const std::string& line) {
+        publish(name, "NTF " + line, false, 0);
+    });
+
+    driver_.set_transmit_callback([this](bool start) {
+        if (!start)
+            transmitting_ = false;
+    });
+
+    receive_connection_ = driver_.signal_receive.connect([this](const protobuf::ModemTransmission& msg) {
+        for (const std::string& frame : msg.frame())
+            publish("DATA", "RX " + hex_encode(frame), true, frame.size());
+    });
+}
+
+goby::acomms::EvologicsBroker::~EvologicsBroker()
+{
+    close();
+    driver_.set_notification_callback(nullptr);
+    driver_.set_transmit_callback(nullptr);
+}
+
+bool goby::acomms::EvologicsBroker::open(const std::string& path)
+{
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd_ < 0)
+        return false;
+
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // left behind by a broker that did not shut down cleanly
+    unlink(path.c_str());
+
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listen_fd_, 8) != 0 || !set_nonblocking(listen_fd_))
+    {
+        std::cout << "Broker failed to listen on " << path << ": " << std::strerror(errno)
+                  << std::endl;
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+
+    path_ = path;
+    return true;
+}
+
+void goby::acomms::EvologicsBroker::close()
+{
+    for (auto& c : clients_) c->closed = true;
+    remove_closed_clients();
+
+    if (listen_fd_ >= 0)
+    {
+        ::close(listen_fd_);
+        unlink(path_.c_str());
+        listen_fd_ = -1;
+    }
+}
+
+void goby::acomms::EvologicsBroker::do_work()
+{
+    driver_.do_work();
+
+    accept_clients();
+
+    for (auto& c : clients_)
+    {
+        read_client(*c);
+        flush_client(*c);
+    }
+
+    transmit_next();
+
+    remove_closed_clients();
+}
+
+std::vector<goby::acomms::EvologicsBroker::ClientStats> goby::acomms::EvologicsBroker::client_stats() const
+{
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<ClientStats> stats;
+    for (const auto& c : clients_)
+    {
+        double seconds = std::chrono::duration<double>(now - c->connected).count();
+        stats.push_back({c->id, c->name, c->tx_frames, c->tx_bytes, c->rx_frames, c->rx_bytes,
+                         c->notifications, c->dropped_lines, c->tx_queue.size(), seconds,
+                         seconds > 0 ? c->tx_bytes / seconds : 0,
+                         seconds > 0 ? c->rx_bytes / seconds : 0});
+    }
+    return stats;
+}
+
+void goby::acomms::EvologicsBroker::accept_clients()
+{
+    if (listen_fd_ < 0)
+        return;
+
+    int fd;
+    while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0)
+    {
+        if (!set_nonblocking(fd))
+        {
+            ::close(fd);
+            continue;
+        }
+
+        std::unique_ptr<Client> c(new Client);
+        c->id = next_client_id_++;
+        c->fd = fd;
+        c->name = "client" + std::to_string(c->id);
+        c->connected = std::chrono::steady_clock::now();
+        std::cout << "Broker: " << c->name << " connected" << std::endl;
+        clients_.push_back(std::move(c));
+    }
+}
+
+void goby::acomms::EvologicsBroker::read_client(Client& c)
+{
+    char buf[4096];
+    while (!c.closed)
+    {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0)
+        {
+            c.in.append(buf, n);
+        }
+        else
+        {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                c.closed = true;
+            break;
+        }
+    }
+
+    size_t end;
+    while (!c.closed && (end = c.in.find('\n')) != std::string::npos)
+    {
+        std::string line = c.in.substr(0, end);
+        c.in.erase(0, end + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            handle_line(c, line);
+    }
+
+    if (c.in.size() > MAX_LINE_BYTES)
+    {
+        std::cout << "Broker: " << c.name << " sent an overlong line, disconnecting" << std::endl;
+        c.closed = true;
+    }
+}
+
+void goby::acomms::EvologicsBroker::flush_client(Client& c)
+{
+    while (!c.closed && !c.out.empty())
+    {
+        ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            c.out.erase(0, n);
+        }
+        else
+        {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                c.closed = true;
+            break;
+        }
+    }
+}
+
+void goby::acomms::EvologicsBroker::handle_line(Client& c, const std::string& line)
+{
+    std::istringstream ss(line);
+    std::string command;
+    ss >> command;
+
+    if (command == "HELLO")
+    {
+        ss >> c.name;
+        send_line(c, "OK HELLO");
+    }
+    else if (command == "SUB" || command == "UNSUB")
+    {
+        std::string topic;
+        while (ss >> topic)
+        {
+            if (command == "SUB")
+                c.topics.insert(topic);
+            else
+                c.topics.erase(topic);
+        }
+        send_line(c, "OK " + command);
+    }
+    else if (command == "SET" || command == "GET")
+    {
+        std::string name;
+        EvologicsSetting setting;
+        if (!(ss >> name) || !EvologicsSettings::from_name(name, &setting))
+        {
+            send_line(c, "ERR unknown setting " + name);
+            return;
+        }
+
+        int value;
+        if (command == "GET")
+        {
+            if (driver_.get_setting(setting, &value))
+                send_line(c, "VAL " + name + " " + std::to_string(value));
+            else
+                send_line(c, "ERR " + name + " not read from the modem yet");
+            return;
+        }
+
+        if (!(ss >> value))
+        {
+            send_line(c, "ERR SET needs a value");
+            return;
+        }
+
+        auto owner = setting_owners_.find(setting);
+        if (owner != setting_owners_.end() && owner->second != c.id)
+        {
+            send_line(c, "ERR " + name + " is owned by another client");
+            return;
+        }
+
+        setting_owners_[setting] = c.id;
+        driver_.set_setting(setting, value);
+        send_line(c, "OK SET " + name + " " + std::to_string(value));
+    }
+    else if (command == "TX")
+    {
+        std::string hex;
+        ss >> hex;
+        // hex_decode() makes something of anything, so garbage would go on the air
+        if (!is_hex(hex))
+        {
+            send_line(c, "ERR TX needs an even number of hex digits");
+            return;
+        }
+        std::string frame = hex_decode(hex);
+        if (frame.empty() || frame.size() > MAX_FRAME_BYTES)
+        {
+            send_line(c, "ERR TX frames must be 1 to " + std::to_string(MAX_FRAME_BYTES) + " bytes");
+            return;
+        }
+        if (c.tx_queue.size() >= MAX_QUEUED_FRAMES)
+        {
+            send_line(c, "ERR TX queue full");
+            return;
+        }
+        c.tx_queue.push_back(frame);
+        send_line(c, "OK TX " + std::to_string(c.tx_queue.size()));
+    }
+    else if (command == "STATS")
+    {
+        for (const ClientStats& s : client_stats())
+        {
+            std::ostringstream stat;
+            stat << "STAT " << s.id << " " << s.name << " tx_frames=" << s.tx_frames
+                 << " tx_bytes=" << s.tx_bytes << " rx_frames=" << s.rx_frames
+                 << " rx_bytes=" << s.rx_bytes << " notifications=" << s.notifications
+                 << " dropped=" << s.dropped_lines << " queued=" << s.queued_frames
+                 << " tx_rate=" << s.tx_rate << " rx_rate=" << s.rx_rate;
+            send_line(c, stat.str());
+        }
+        send_line(c, "OK STATS");
+    }
+    else
+    {
+        send_line(c, "ERR unknown command " + command);
+    }
+}
+
+void goby::acomms::EvologicsBroker::send_line(Client& c, const std::string& line)
+{
+    if (c.out.size() + line.size() + 1 > client_buffer_limit_)
+    {
+        c.dropped_lines++;
+        return;
+    }
+    c.out += line;
+    c.out += '\n';
+}
+
+void goby::acomms::EvologicsBroker::publish(const std::string& topic, const std::string& line,
+                                            bool data, size_t bytes)
+{
+    for (auto& c : clients_)
+    {
+        if (c->closed || !(c->topics.count(topic) || c->topics.count("*")))
+            continue;
+
+        if (data)
+        {
+            c->rx_frames++;
+            c->rx_bytes += bytes;
+        }
+        else
+        {
+            c->notifications++;
+        }
+        send_line(*c, line);
+    }
+}
+
+void goby::acomms::EvologicsBroker::transmit_next()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    // the driver held the last frame back (a settings read, an earlier backlog); its SENDEND
+    // can only come once it is written, so wait for that before timing it
+    if (transmit_held_)
+    {
+        if (driver_.outbound_queued() > 0)
+            return;
+        transmit_held_ = false;
+        transmitting_ = true;
+        transmit_start_ = now;
+    }
+
+    if (transmitting_ && now - transmit_start_ < transmit_timeout_)
+        return;
+    transmitting_ = false;
+
+    // held in the client queues rather than the driver's while the link is down, or while the
+    // driver still holds frames back, which this one would only queue behind
+    if (clients_.empty() || !driver_.is_connected() || driver_.outbound_queued() > 0)
+        return;
+
+    // round robin, one frame per client per turn: airtime is mostly per frame overhead
+    for (size_t visited = 0; visited < clients_.size(); visited++)
+    {
+        Client& c = *clients_[round_robin_++ % clients_.size()];
+        if (c.closed || c.tx_queue.empty())
+            continue;
+
+        const std::string& frame = c.tx_queue.front();
+        c.tx_frames++;
+        c.tx_bytes += frame.size();
+
+        protobuf::ModemTransmission msg;
+        msg.set_type(protobuf::ModemTransmission::DATA);
+        msg.add_frame(frame);
+        c.tx_queue.pop_front();
+
+        driver_.handle_initiate_transmission(msg);
+        if (driver_.outbound_queued() > 0)
+        {
+            transmit_held_ = true;
+        }
+        else
+        {
+            transmitting_ = true;
+            transmit_start_ = now;
+        }
+        return;
+    }
+}
+
+bool goby::acomms::EvologicsBroker::is_hex(const std::string& s)
+{
+    return !s.empty() && s.size() % 2 == 0 &&
+           std::all_of(s.begin(), s.end(), [](char ch) { return std::isxdigit(static_cast<unsigned char>(ch)); });
+}
+
+void goby::acomms::EvologicsBroker::remove_closed_clients()
+{
+    for (auto& c : clients_)
+    {
+        if (!c->closed)
+            continue;
+
+        std::cout << "Broker: " << c->name << " disconnected" << std::endl;
+        ::close(c->fd);
+
+        // its settings are free for others to take
+        for (auto it = setting_owners_.begin(); it != setting_owners_.end();)
+        {
+            if (it->second == c->id)
+                it = setting_owners_.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    clients_.erase(std::remove_if(clients_.begin(), clients_.end(),
+                                  [](const std::unique_ptr<Client>& c) { return c->closed; }),
+                   clients_.end());
+}
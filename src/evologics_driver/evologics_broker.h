@@ -0,0 +1,146 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_BROKER_H
+#define GOBY_ACOMMS_MODEMDRIVER_EVO_BROKER_H
+
+#include <chrono>  // for steady_clock
+#include <cstdint> // for uint64_t
+#include <deque>   // for deque
+#include <map>     // for map
+#include <memory>  // for unique_ptr
+#include <set>     // for set
+#include <string>  // for string
+#include <vector>  // for vector
+
+#include <boost/signals2/connection.hpp>
+
+#include "evologics_driver.h"
+
+namespace goby
+{
+namespace acomms
+{
+/// \class EvologicsBroker evologics_broker.h
+/// \brief Shares one EvologicsDriver, and so one modem link, between local client processes.
+///
+/// Clients connect to a unix stream socket and speak a line protocol:
+///
+///     client -> broker              broker -> client
+///     HELLO <name>                  OK HELLO
+///     SUB <topic> [<topic> ...]     OK SUB
+///     UNSUB <topic> [<topic> ...]   OK UNSUB
+///     SET <setting> <value>         OK SET <setting> <value>, or ERR ...
+///     GET <setting>                 VAL <setting> <value>, or ERR ...
+///     TX <hex>                      OK TX <frames queued>, or ERR ...
+///     STATS                         STAT ... per client, then OK STATS
+///                                   NTF <raw AT line>   notifications, topic is their name (USBLLONG, ...)
+///                                   RX <hex>            received data frames, topic DATA
+///
+/// Topic * is everything. Settings use the names from EvologicsSettings::name(); the
+/// first client to SET a setting owns it until it disconnects and writes from others
+/// are refused. Outgoing frames are queued per client and sent one at a time (the next
+/// after SENDEND, or once the driver has written a frame it had to hold back), taking one
+/// frame from each client in turn so a busy client cannot starve the rest.
+/// The broker takes over the driver's transmit and notification callbacks and calls its
+/// do_work(). Nothing blocks: a client that does not keep up loses lines.
+class EvologicsBroker
+{
+  public:
+    struct ClientStats
+    {
+        int id;
+        std::string name;
+        uint64_t tx_frames;
+        uint64_t tx_bytes;
+        uint64_t rx_frames;
+        uint64_t rx_bytes;
+        uint64_t notifications;
+        uint64_t dropped_lines;
+        size_t queued_frames;
+        double connected_seconds;
+        // bytes per second since the client connected
+        double tx_rate;
+        double rx_rate;
+    };
+
+    explicit EvologicsBroker(EvologicsDriver& driver);
+    ~EvologicsBroker();
+
+    /// \brief Listen on a unix socket at path, replacing any stale socket file.
+    bool open(const std::string& path);
+
+    void close();
+
+    /// \brief Run the driver, then serve clients and the transmit queue. Never blocks.
+    void do_work();
+
+    std::vector<ClientStats> client_stats() const;
+
+    /// \brief Send the next queued frame if no SENDEND has been seen this long after the last.
+    void set_transmit_timeout(std::chrono::milliseconds timeout) { transmit_timeout_ = timeout; }
+
+    /// \brief Output a client may have waiting before further lines to it are dropped.
+    void set_client_buffer_limit(size_t bytes) { client_buffer_limit_ = bytes; }
+
+  private:
+    struct Client
+    {
+        int id;
+        int fd;
+        std::string name;
+        bool closed{false};
+        std::string in;
+        std::string out;
+        std::set<std::string> topics;
+        std::deque<std::string> tx_queue;
+        uint64_t tx_frames{0};
+        uint64_t tx_bytes{0};
+        uint64_t rx_frames{0};
+        uint64_t rx_bytes{0};
+        uint64_t notifications{0};
+        uint64_t dropped_lines{0};
+        std::chrono::steady_clock::time_point connected;
+    };
+
+    static const size_t MAX_FRAME_BYTES = 1000;
+    static const size_t MAX_QUEUED_FRAMES = 64;
+    static const size_t MAX_LINE_BYTES = 4096;
+
+    static bool is_hex(const std::string& s);
+    void accept_clients();
+    void read_client(Client& c);
+    void flush_client(Client& c);
+    void handle_line(Client& c, const std::string& line);
+    void send_line(Client& c, const std::string& line);
+    void publish(const std::string& topic, const std::string& line, bool data, size_t bytes);
+    void transmit_next();
+    void remove_closed_clients();
+
+    EvologicsDriver& driver_;
+    boost::signals2::scoped_connection receive_connection_;
+
+    std::string path_;
+    int listen_fd_{-1};
+    int next_client_id_{1};
+    std::vector<std::unique_ptr<Client>> clients_;
+
+    // which client owns each setting it has written
+    std::map<EvologicsSetting, int> setting_owners_;
+
+    size_t round_robin_{0};
+    bool transmitting_{false};
+    // the last frame is held in the driver's outbound queue, so no SENDEND is coming for it yet
+    bool transmit_held_{false};
+    std::chrono::steady_clock::time_point transmit_start_;
+    std::chrono::milliseconds transmit_timeout_{10000};
+
+    size_t client_buffer_limit_{256 * 1024};
+};
+} // namespace acomms
+} // namespace goby
+#endif
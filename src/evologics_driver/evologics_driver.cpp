@@ -58,17 +58,73 @@ using namespace goby::util::logger_lock;
 const std::string goby::acomms::EvologicsDriver::SERIAL_DELIMITER = "\r\n";
 const std::string goby::acomms::EvologicsDriver::ETHERNET_DELIMITER = "\r\n";
 
-goby::acomms::EvologicsDriver::EvologicsDriver()
+goby::acomms::EvologicsDriver::EvologicsDriver() : outbound_queue_(256)
 {
 
-    encoder_.set_transmit_callback(
+    protocol_.set_command_callback(
         std::bind(&EvologicsDriver::config_write, this, std::placeholders::_1));
 
-    decoder_.set_decode_callback(
-        std::bind(&EvologicsDriver::on_decode, this, std::placeholders::_1));
+    protocol_.set_data_callback(
+        std::bind(&EvologicsDriver::process_receive, this, std::placeholders::_1));
+
+    protocol_.set_reply_callback(
+        std::bind(&EvologicsDriver::process_at_receive, this, std::placeholders::_1));
+
+    protocol_.set_usbl_callback(
+        std::bind(&EvologicsDriver::on_usbllong, this, std::placeholders::_1));
+
+    protocol_.set_angles_callback(
+        std::bind(&EvologicsDriver::on_usbl_angles, this, std::placeholders::_1));
+
+    protocol_.set_phyd_callback([this](const UsblPhydMsg& phyd) {
+        if (phyd_callback_)
+        {
+            phyd_callback_(phyd);
+        }
+    });
+
+    protocol_.set_transmit_callback([this](bool start) {
+        if (transmit_callback_)
+        {
+            transmit_callback_(start);
+        }
+    });
+
+    // bulk frames are stuffed for the line, so they skip compression (which would undo it);
+    // application frames that start like one are escaped by compression_.encode()
+    bulk_.set_frame_callback(
+        std::bind(&EvologicsDriver::evologics_write, this, std::placeholders::_1));
+
+    protocol_.set_instant_message_callback([this](int address, bool delivered) {
+        usbl_scheduler_.on_reply(address, delivered, steady_time());
+    });
+
+    // AT*SENDIM,<length>,<destination>,ack,<data>
+    usbl_ping_.command = "*SENDIM";
+    usbl_ping_.data = {"1", "", "ack", "P"};
+
+    protocol_.set_decode_error_callback([this](hayes::AtStatus status, std::string_view raw) {
+        if (decode_error_callback_)
+        {
+            callback_line_.assign(raw);
+            decode_error_callback_(status, callback_line_);
+        }
+    });
+
+    protocol_.set_notification_callback([this](const std::string& name, std::string_view line) {
+        if (notification_callback_)
+        {
+            callback_line_.assign(line);
+            notification_callback_(name, callback_line_);
+        }
+    });
 }
 
-goby::acomms::EvologicsDriver::~EvologicsDriver() = default;
+goby::acomms::EvologicsDriver::~EvologicsDriver()
+{
+    if (reconnect_future_.valid())
+        reconnect_future_.wait();
+}
 
 void goby::acomms::EvologicsDriver::startup(const protobuf::DriverConfig& cfg)
 {
@@ -93,6 +149,7 @@ void goby::acomms::EvologicsDriver::startup(const protobuf::DriverConfig& cfg)
     {
         case protobuf::DriverConfig::CONNECTION_SERIAL:
             driver_cfg_.set_line_delimiter(SERIAL_DELIMITER);
+            protocol_.set_link(EvologicsProtocol::Link::SERIAL);
 
             if (!cfg.has_serial_baud())
                 driver_cfg_.set_serial_baud(DEFAULT_BAUD);
@@ -101,6 +158,7 @@ void goby::acomms::EvologicsDriver::startup(const protobuf::DriverConfig& cfg)
 
         case protobuf::DriverConfig::CONNECTION_TCP_AS_CLIENT:
             driver_cfg_.set_line_delimiter(ETHERNET_DELIMITER);
+            protocol_.set_link(EvologicsProtocol::Link::TCP);
 
             if(!cfg.has_tcp_server())
                 driver_cfg_.set_tcp_server(DEFAULT_TCP_SERVER);
@@ -115,197 +173,325 @@ void goby::acomms::EvologicsDriver::startup(const protobuf::DriverConfig& cfg)
 
     }
 
+    if (fixed_memory_)
+        reserve_fixed_memory();
+
+    if (!usbl_shm_name_.empty() && !usbl_shm_.open(usbl_shm_name_, usbl_shm_capacity_))
+        throw ModemDriverException("Failed to open USBL shared memory: " + usbl_shm_name_);
+
     modem_start(driver_cfg_);
+    link_state_ = LinkState::CONNECTED;
+    last_rx_ = std::chrono::steady_clock::now();
 
     clear_buffer();
 
+    // anything written before startup
+    flush_outbound_queue();
+
+    if (compression_.enabled())
+        send_compression_offer();
+
+    // a warm start restores the desired profile from the last run and only
+    // writes whatever the batch read shows has changed on the modem
+    if (!settings_cache_file_.empty() && settings_.load(settings_cache_file_))
+        std::cout << "Loaded settings cache: " << settings_cache_file_ << std::endl;
+
+    read_settings();
+
     startup_done_ = true;
 }
 
+void goby::acomms::EvologicsDriver::set_outbound_queue_size(size_t size)
+{
+    outbound_queue_.clear();
+    outbound_queue_.resize(size);
+    outbound_head_ = 0;
+    outbound_count_ = 0;
+}
+
+void goby::acomms::EvologicsDriver::reserve_fixed_memory()
+{
+    size_t max_line = fixed_memory_cfg_.max_line_bytes;
+
+    protocol_.reserve(max_line, fixed_memory_cfg_.max_fields);
+
+    rx_line_.reserve(max_line);
+    tx_line_.reserve(max_line);
+    callback_line_.reserve(max_line);
+    raw_in_.mutable_raw()->reserve(max_line);
+    raw_out_.mutable_raw()->reserve(max_line);
+
+    for (std::string& slot : outbound_queue_) slot.reserve(max_line);
+
+    // every data frame goes through the escape, whether or not it is compressed
+    compressed_tx_.reserve(max_line);
+    compressed_rx_.reserve(max_line);
+    if (compression_.enabled())
+        compression_.reserve(max_line);
+
+    // cleared repeated fields keep their strings for reuse
+    receive_msg_.add_frame()->reserve(max_line);
+    receive_msg_.Clear();
+    transmit_msg_.add_frame()->reserve(max_line);
+    transmit_msg_.Clear();
+
+    std::cout << "Fixed memory mode: " << fixed_memory_bytes() << " bytes preallocated" << std::endl;
+}
+
+size_t goby::acomms::EvologicsDriver::fixed_memory_bytes() const
+{
+    if (!fixed_memory_)
+        return 0;
+
+    size_t bytes = protocol_.reserved_bytes();
+    bytes += rx_line_.capacity() + tx_line_.capacity() + callback_line_.capacity();
+    bytes += raw_in_.raw().capacity() + raw_out_.raw().capacity();
+    for (const std::string& slot : outbound_queue_) bytes += sizeof(slot) + slot.capacity();
+    bytes += 2 * fixed_memory_cfg_.max_line_bytes; // receive_msg_ and transmit_msg_ frames
+    bytes += compressed_tx_.capacity() + compressed_rx_.capacity();
+    if (compression_.enabled())
+        bytes += compression_.reserved_bytes();
+    return bytes;
+}
+
 void goby::acomms::EvologicsDriver::clear_buffer()
 {
     hayes::AtMsg msg;
     msg.command = "Z4";
-    encoder_.encode(msg);
+    protocol_.encode(msg);
 }
 
 void goby::acomms::EvologicsDriver::shutdown()
 {
+    save_settings_cache();
+
+    if (reconnect_future_.valid())
+        reconnect_future_.wait();
+    link_state_ = LinkState::DISCONNECTED;
+
     ModemDriverBase::modem_close();
+
+    usbl_shm_.close();
 }
 
-void goby::acomms::EvologicsDriver::extended_notification_on()
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::extended_notification_on()
 {
-    hayes::AtMsg msg;
-    msg.command = "@ZX1";
-    encoder_.encode(msg);   
+    return submit_command("@ZX1", true);
 }
-void goby::acomms::EvologicsDriver::extended_notification_off()
+
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::extended_notification_off()
 {
-    hayes::AtMsg msg;
-    msg.command = "@ZX0";
-    encoder_.encode(msg);   
+    return submit_command("@ZX0", true);
 }
-void goby::acomms::EvologicsDriver::set_source_level(int source_level)
+
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_source_level(int source_level)
 {
-    hayes::AtMsg msg;
-    msg.command = "!L" + std::to_string(source_level);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::SOURCE_LEVEL, source_level);
 }
 
-void goby::acomms::EvologicsDriver::set_source_control(int source_control)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_source_control(int source_control)
 {
-    hayes::AtMsg msg;
-    msg.command = "!LC" + std::to_string(source_control);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::SOURCE_CONTROL, source_control);
+}
 
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_gain(int gain)
+{
+    return submit_setting(EvologicsSetting::GAIN, gain);
 }
 
-void goby::acomms::EvologicsDriver::set_gain(int gain)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_carrier_waveform_id(int id)
 {
-    hayes::AtMsg msg;
-    msg.command = "!G" + std::to_string(gain);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::CARRIER_WAVEFORM_ID, id);
 }
 
-void goby::acomms::EvologicsDriver::set_carrier_waveform_id(int id)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_local_address(int address)
 {
-    hayes::AtMsg msg;
-    msg.command = "!C" + std::to_string(id);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::LOCAL_ADDRESS, address);
 }
 
-void goby::acomms::EvologicsDriver::set_local_address(int address)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_remote_address(int address)
 {
-    hayes::AtMsg msg;
-    msg.command = "!AL" + std::to_string(address);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::REMOTE_ADDRESS, address);
 }
 
-void goby::acomms::EvologicsDriver::set_remote_address(int address)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_highest_address(int address)
 {
-    hayes::AtMsg msg;
-    msg.command = "!AR" + std::to_string(address);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::HIGHEST_ADDRESS, address);
 }
 
-void goby::acomms::EvologicsDriver::set_highest_address(int address)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_cluster_size(int size)
 {
-    hayes::AtMsg msg;
-    msg.command = "!AM" + std::to_string(address);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::CLUSTER_SIZE, size);
 }
 
-void goby::acomms::EvologicsDriver::set_cluster_size(int size)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_packet_time(int time)
 {
-    hayes::AtMsg msg;
-    msg.command = "!ZC" + std::to_string(size);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::PACKET_TIME, time);
 }
 
-void goby::acomms::EvologicsDriver::set_packet_time(int time)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_retry_count(int count)
 {
-    hayes::AtMsg msg;
-    msg.command = "!ZP" + std::to_string(time);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::RETRY_COUNT, count);
 }
 
-void goby::acomms::EvologicsDriver::set_retry_count(int count)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_retry_timeout(int time)
 {
-    hayes::AtMsg msg;
-    msg.command = "!RC" + std::to_string(count);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::RETRY_TIMEOUT, time);
 }
 
-void goby::acomms::EvologicsDriver::set_retry_timeout(int time)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_keep_online_count(int count)
 {
-    hayes::AtMsg msg;
-    msg.command = "!RT" + std::to_string(time);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::KEEP_ONLINE_COUNT, count);
 }
 
-void goby::acomms::EvologicsDriver::set_keep_online_count(int count)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_idle_timeout(int time)
 {
-    hayes::AtMsg msg;
-    msg.command = "!KO" + std::to_string(count);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::IDLE_TIMEOUT, time);
 }
 
-void goby::acomms::EvologicsDriver::set_idle_timeout(int time)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_channel_protocol_id(int id)
 {
-    hayes::AtMsg msg;
-    msg.command = "!ZI" + std::to_string(time);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::CHANNEL_PROTOCOL_ID, id);
 }
 
-void goby::acomms::EvologicsDriver::set_channel_protocol_id(int id)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::set_sound_speed(int speed)
 {
-    hayes::AtMsg msg;
-    msg.command = "!ZS" + std::to_string(id);
-    encoder_.encode(msg);
+    return submit_setting(EvologicsSetting::SOUND_SPEED, speed);
 }
 
-void goby::acomms::EvologicsDriver::set_sound_speed(int speed)
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::save_settings()
 {
-    hayes::AtMsg msg;
-    msg.command = "!CA" + std::to_string(speed);
-    encoder_.encode(msg);
+    return submit_command("&W");
 }
 
-void goby::acomms::EvologicsDriver::save_settings()
+goby::acomms::EvologicsDriver::CommandHandle goby::acomms::EvologicsDriver::factory_reset()
 {
-    hayes::AtMsg msg;
-    msg.command = "&W";
-    encoder_.encode(msg);
+    return submit_command("&F");
 }
 
-void goby::acomms::EvologicsDriver::factory_reset()
+void goby::acomms::EvologicsDriver::set_setting(EvologicsSetting setting, int value)
 {
+    settings_.set_desired(setting, value);
+    sync_setting(setting);
+}
+
+void goby::acomms::EvologicsDriver::apply_settings(const EvologicsSettingsProfile& profile)
+{
+    settings_.set_desired(profile);
+
+    for (const auto& p : profile)
+        sync_setting(p.first);
+
+    save_settings_cache();
+}
+
+void goby::acomms::EvologicsDriver::read_settings()
+{
+    // queue every query at once; the answers are matched up in process_at_receive
+    for (EvologicsSetting setting : EvologicsSettings::all())
+    {
+        hayes::AtMsg msg;
+        msg.command = EvologicsSettings::query_command(setting);
+        protocol_.encode(msg);
+        settings_.set_read_pending(setting, true);
+    }
+    settings_read_start_ = std::chrono::steady_clock::now();
+}
+
+void goby::acomms::EvologicsDriver::sync_setting(EvologicsSetting setting)
+{
+    // deferred until the pending read tells us what the modem has
+    if (!settings_.needs_write(setting))
+    {
+        // a queued write completes without one if the modem already has the value
+        if (!settings_.read_pending(setting))
+            commands_.resolve_deferred(setting, CommandResult::OK);
+        return;
+    }
+
+    // the read after the reconnect finds out what the modem has and writes it then
+    if (link_state_ != LinkState::CONNECTED)
+        return;
+
+    int value = 0;
+    settings_.desired(setting, &value);
+
     hayes::AtMsg msg;
-    msg.command = "&F";
-    encoder_.encode(msg);
+    msg.command = EvologicsSettings::set_command(setting) + std::to_string(value);
+    protocol_.encode(msg);
+    commands_.setting_written(setting, steady_time());
+
+    // assume success, an ERROR reply invalidates it again
+    settings_.set_value(setting, value);
+}
+
+void goby::acomms::EvologicsDriver::issue_commands()
+{
+    commands_.drain(&drained_commands_);
+
+    for (EvologicsCommandQueue::Command& c : drained_commands_)
+    {
+        if (c.is_setting)
+        {
+            // held until the write goes out, which waits for any outstanding read
+            commands_.defer(c.setting, std::move(c.promise));
+            settings_.set_desired(c.setting, c.value);
+            sync_setting(c.setting);
+            continue;
+        }
+
+        hayes::AtMsg msg;
+        msg.command = c.command;
+        protocol_.encode(msg);
+        commands_.await_reply(c.command, std::move(c.promise), steady_time());
+
+        if (c.command == "&F")
+        {
+            // every setting may have changed, so find out what the modem has now
+            settings_.invalidate_all();
+            read_settings();
+        }
+    }
+}
+
+void goby::acomms::EvologicsDriver::save_settings_cache()
+{
+    if (settings_cache_file_.empty())
+        return;
+
+    if (!settings_.save(settings_cache_file_))
+        std::cout << "Failed to write settings cache: " << settings_cache_file_ << std::endl;
 }
 
 
 void goby::acomms::EvologicsDriver::do_work()
 {
+    // never blocks, while the link is down there is nothing to read
+    if (!check_link())
+        return;
+
+    // submitted commands stay queued while the link is down, so no reply timer starts
+    // for a write that cannot go out
+    issue_commands();
 
     // read any incoming messages from the modem
-    std::string raw_str;
-    while (modem_read(&raw_str))
+    std::string& raw_str = rx_line_;
+    while (link_read(&raw_str))
     {
-        raw_str.pop_back();
-        raw_str.pop_back();
-        // try to handle the received message, posting appropriate signals
-        try
-        {
-            std::string command_str = "+++";
+        last_rx_ = std::chrono::steady_clock::now();
+        probe_sent_ = false;
 
-            size_t split_index = raw_str.find_first_of(command_str);
-
-            //it is for sure an AT message
-            if(split_index == 0)
-            {
-                std::cout << "RX: " << raw_str << std::endl;
-                decoder_.decode(raw_str);
-            }
-            //this is some combo binary then AT
-            else if(split_index != std::string::npos)
-            {
-                buffer_.append(raw_str.substr(0,split_index));
-                std::cout << "RX: " << raw_str.substr(split_index) << std::endl;
-                decoder_.decode(raw_str.substr(split_index));
-            }
-            else
-            {
-                buffer_.append(raw_str);
-                std::cout << "RX: " << hex_encode(buffer_) << std::endl;
-                
-                process_receive(buffer_);
-                buffer_.clear();                
-            }
+        double host_time = std::chrono::duration<double>(
+                               std::chrono::system_clock::now().time_since_epoch()).count();
 
+        // console tracing allocates, so it is off in the fixed memory mode
+        if (!fixed_memory_ && raw_str.compare(0, 3, "+++") == 0)
+            std::cout << "RX: " << raw_str;
 
+        // try to handle the received message, posting appropriate signals
+        try
+        {
+            protocol_.process_line(raw_str, host_time);
         }
         catch (std::exception& e)
         {
@@ -313,19 +499,73 @@ void goby::acomms::EvologicsDriver::do_work()
         }   
     }
 
+    commands_.expire(steady_time());
+
+    bulk_.do_work(steady_time());
+
+    if (compression_.offer_due(steady_time()))
+        send_compression_offer();
+
+    int ping_address = 0;
+    if (usbl_scheduler_.active() && usbl_scheduler_.next_ping(steady_time(), &ping_address))
+        send_usbl_ping(ping_address);
+
+    if (settings_.reads_outstanding() &&
+        std::chrono::steady_clock::now() - settings_read_start_ > SETTINGS_READ_TIMEOUT)
+    {
+        std::cout << "Timed out reading settings, writing desired values unconditionally" << std::endl;
+        for (EvologicsSetting setting : EvologicsSettings::all())
+        {
+            if (!settings_.read_pending(setting))
+                continue;
+            settings_.set_read_pending(setting, false);
+            settings_.invalidate(setting);
+            sync_setting(setting);
+        }
+        flush_outbound_queue();
+    }
+
 }   
 
 void goby::acomms::EvologicsDriver::process_receive(std::string &s)
 {
 
-    if(s.back() == '\n'){ s.pop_back(); }
+    if(!s.empty() && s.back() == '\n'){ s.pop_back(); }
 
-    protobuf::ModemRaw raw_msg;
-    raw_msg.set_raw(s);
+    if (!fixed_memory_)
+        std::cout << "RX: " << hex_encode(s) << std::endl;
+
+    raw_in_.set_raw(s);
+
+    signal_raw_incoming(raw_in_);
+
+    // bulk transfer segments and acknowledgements never reach the application. They are
+    // matched on the wire, where an application frame starting like one has been escaped
+    if (EvologicsBulkTransfer::is_bulk_frame(s))
+    {
+        bulk_.on_frame(s, steady_time());
+        return;
+    }
 
-    signal_raw_incoming(raw_msg);
+    bool send_offer = false;
+    switch (compression_.decode(s, &compressed_rx_, &send_offer))
+    {
+        case EvologicsCompression::Frame::OFFER:
+            std::cout << "Peer offered compression" << std::endl;
+            if (send_offer)
+                send_compression_offer();
+            return;
+
+        case EvologicsCompression::Frame::INVALID:
+            // the peer's idea of our dictionaries is out of date, offer_due() re-offers soon
+            std::cout << "Dropped a data frame that failed to decompress" << std::endl;
+            return;
+
+        case EvologicsCompression::Frame::DATA:
+            break;
+    }
 
-    receive_msg_.add_frame(s);
+    receive_msg_.add_frame(compressed_rx_);
 
     signal_receive_and_clear(&receive_msg_);
     
@@ -373,9 +613,7 @@ void goby::acomms::EvologicsDriver::data_transmission(protobuf::ModemTransmissio
 
     if (!(msg->frame_size() == 0 || msg->frame(0).empty()))
     {
-        
-        evologics_write(msg->frame(0));
-
+        write_data_frame(msg->frame(0));
     }
     else
     {
@@ -383,131 +621,388 @@ void goby::acomms::EvologicsDriver::data_transmission(protobuf::ModemTransmissio
     }
 }
 
+void goby::acomms::EvologicsDriver::write_data_frame(const std::string& frame)
+{
+    compression_.encode(frame, &compressed_tx_);
+    evologics_write(compressed_tx_);
+}
+
 void goby::acomms::EvologicsDriver::evologics_write(const std::string &s)
 {
-    protobuf::ModemRaw raw_msg;
-    raw_msg.set_raw(s);
+    // a data frame never overtakes a control write (e.g. a new remote address): queued
+    // commands go out first, before tx_line_ is taken for the frame
+    if (link_state_ == LinkState::CONNECTED)
+        issue_commands();
+
+    raw_out_.set_raw(s);
                             
-    signal_raw_outgoing(raw_msg);
+    signal_raw_outgoing(raw_out_);
+
+    if (!fixed_memory_)
+        std::cout << "TX: " << hex_encode(s) << std::endl;
 
-    std::cout << "TX: " << hex_encode(s) << std::endl;
+    protocol_.frame_data(raw_out_.raw(), &tx_line_);
 
-    if(driver_cfg_.connection_type() == protobuf::DriverConfig::CONNECTION_SERIAL)
+    // and waits behind setting writes held for a read, in order with frames already waiting
+    if (link_state_ == LinkState::CONNECTED && !outbound_queue_.empty() &&
+        (settings_.writes_held() || outbound_count_ > 0))
     {
-        modem_write(raw_msg.raw()+"\r\n");
+        queue_outbound(tx_line_);
+        return;
     }
-    else if(driver_cfg_.connection_type() == protobuf::DriverConfig::CONNECTION_TCP_AS_CLIENT)
+    link_write(tx_line_);
+}
+
+void goby::acomms::EvologicsDriver::send_compression_offer()
+{
+    compression_.make_offer(&compressed_tx_, steady_time());
+    evologics_write(compressed_tx_);
+}
+
+bool goby::acomms::EvologicsDriver::check_link()
+{
+    if (!startup_done_)
+        return false;
+
+    auto now = std::chrono::steady_clock::now();
+
+    switch (link_state_)
     {
-        modem_write(raw_msg.raw()+"\r\n");
+        case LinkState::CONNECTED:
+            if (link_timeout_.count() > 0 && now - last_rx_ > link_timeout_)
+            {
+                // a quiet modem is normal, so ask it something before giving up on it
+                if (!probe_sent_)
+                {
+                    probe_sent_ = true;
+                    probe_time_ = now;
+                    hayes::AtMsg msg;
+                    msg.command = EvologicsSettings::query_command(EvologicsSetting::LOCAL_ADDRESS);
+                    protocol_.encode(msg);
+                }
+                else if (now - probe_time_ > link_timeout_)
+                {
+                    link_lost("no reply to probe");
+                    return false;
+                }
+            }
+            return link_state_ == LinkState::CONNECTED;
+
+        case LinkState::DISCONNECTED:
+            if (now >= next_reconnect_)
+            {
+                std::cout << "Reconnecting to modem" << std::endl;
+                link_state_ = LinkState::RECONNECTING;
+                // modem_start blocks until the link is up or times out, so keep it off the do_work thread.
+                // do_work does not touch the connection again until this finishes.
+                reconnect_future_ = std::async(std::launch::async, [this]() {
+                    try
+                    {
+                        modem_close();
+                        modem_start(driver_cfg_);
+                        return true;
+                    }
+                    catch (std::exception& e)
+                    {
+                        std::cout << "Reconnect failed: " << e.what() << std::endl;
+                        return false;
+                    }
+                });
+            }
+            return false;
+
+        case LinkState::RECONNECTING:
+            if (reconnect_future_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return false;
+
+            if (!reconnect_future_.get())
+            {
+                next_reconnect_ = now + reconnect_backoff_;
+                reconnect_backoff_ = std::min(reconnect_backoff_ * 2, reconnect_backoff_max_);
+                link_state_ = LinkState::DISCONNECTED;
+                return false;
+            }
+
+            std::cout << "Reconnected to modem" << std::endl;
+            link_state_ = LinkState::CONNECTED;
+            reconnect_backoff_ = reconnect_backoff_initial_;
+            last_rx_ = now;
+            probe_sent_ = false;
+
+            // commands queued while the link was down go ahead of the frames that waited with them
+            issue_commands();
+            flush_outbound_queue();
+
+            // lost again while flushing, link_lost() has already scheduled the next attempt
+            if (link_state_ != LinkState::CONNECTED)
+                return false;
+
+            bulk_.link_restored();
+
+            // the modem may have been power cycled, put the desired settings back
+            read_settings();
+
+            if (connection_callback_)
+            {
+                connection_callback_(true);
+            }
+            return link_state_ == LinkState::CONNECTED;
     }
+    return false;
 }
 
-void goby::acomms::EvologicsDriver::config_write(const std::string &s)
+void goby::acomms::EvologicsDriver::link_lost(const std::string& reason)
 {
-    protobuf::ModemRaw raw_msg;
-    raw_msg.set_raw(s);
-                            
-    signal_raw_outgoing(raw_msg);
+    if (link_state_ != LinkState::CONNECTED)
+        return;
+
+    std::cout << "Lost connection to modem: " << reason << std::endl;
 
-    std::cout << "TX: " << s << std::endl;
+    link_state_ = LinkState::DISCONNECTED;
+    next_reconnect_ = std::chrono::steady_clock::now();
 
-    if(driver_cfg_.connection_type() == protobuf::DriverConfig::CONNECTION_SERIAL)
+    if (connection_callback_)
     {
-        modem_write(raw_msg.raw()+"\r");
+        connection_callback_(false);
     }
-    else if(driver_cfg_.connection_type() == protobuf::DriverConfig::CONNECTION_TCP_AS_CLIENT)
+}
+
+bool goby::acomms::EvologicsDriver::link_read(std::string* s)
+{
+    if (link_state_ != LinkState::CONNECTED)
+        return false;
+
+    try
+    {
+        return modem_read(s);
+    }
+    catch (ModemDriverException& e)
     {
-        modem_write(raw_msg.raw()+"\n");
+        link_lost(e.what());
+        return false;
     }
 }
 
-void goby::acomms::EvologicsDriver::on_decode(const hayes::AtMsg msg)
+void goby::acomms::EvologicsDriver::link_write(const std::string& s)
 {
-
-    if(msg.command == "USBLLONG")
+    std::string lost_reason;
+    if (link_state_ == LinkState::CONNECTED)
     {
-        UsbllongMsg usbl;
-
-        usbl.current_time = std::stod(msg.data[0]);
-        usbl.measurement_time = std::stod(msg.data[1]);
-        usbl.remote_address = std::stoi(msg.data[2]);
-        usbl.xyz.x = std::stof(msg.data[3]);
-        usbl.xyz.y = std::stof(msg.data[4]);
-        usbl.xyz.z = std::stof(msg.data[5]);
-        usbl.enu.e = std::stof(msg.data[6]);
-        usbl.enu.n = std::stof(msg.data[7]);
-        usbl.enu.u = std::stof(msg.data[8]);
-        usbl.rpy.roll = std::stof(msg.data[9]);
-        usbl.rpy.pitch = std::stof(msg.data[10]);
-        usbl.rpy.yaw = std::stof(msg.data[11]);
-        usbl.propogation_time = std::stof(msg.data[12]);
-        usbl.rssi = std::stoi(msg.data[13]);
-        usbl.integrity = std::stoi(msg.data[14]);
-        usbl.accuracy = std::stof(msg.data[15]);
-
-        if(usbl_callback_)
+        try
         {
-            usbl_callback_(usbl);
+            modem_write(s);
+            return;
         }
-    }
-    else if(msg.command == "SENDSTART")
-    {
-        if(transmit_callback_)
+        catch (ModemDriverException& e)
         {
-            transmit_callback_(true);
+            lost_reason = e.what();
         }
     }
-    else if(msg.command == "SENDEND")
+
+    queue_outbound(s);
+
+    // after queueing, s may be one of our buffers and the connection callback may write again
+    if (!lost_reason.empty())
+        link_lost(lost_reason);
+}
+
+void goby::acomms::EvologicsDriver::queue_outbound(const std::string& s)
+{
+    if (outbound_queue_.empty())
     {
-        if(transmit_callback_)
-        {
-            transmit_callback_(false);
-        }
+        outbound_dropped_++;
+        return;
     }
-    else if(msg.command == "USBLANGLES")
+
+    if (outbound_count_ == outbound_queue_.size())
     {
-        UsblAnglesMsg angles;
-        angles.current_time = std::stof(msg.data[0]);
-        angles.measurement_time = std::stof(msg.data[1]);
-        angles.remote_address = std::stoi(msg.data[2]);
-        angles.local_bearing = std::stof(msg.data[3]);
-        angles.local_elevation = std::stof(msg.data[4]);
-        angles.bearing = std::stof(msg.data[5]);
-        angles.elevation = std::stof(msg.data[6]);
-        angles.roll = std::stof(msg.data[7]);
-        angles.pitch = std::stof(msg.data[8]);
-        angles.yaw = std::stof(msg.data[9]);
-        angles.rssi = std::stoi(msg.data[10]);
-        angles.integrity = std::stoi(msg.data[11]);
-        angles.accuracy = std::stof(msg.data[12]);
-
-        if(angles_callback_)
-        {
-            angles_callback_(angles);
-        }
+        outbound_head_ = (outbound_head_ + 1) % outbound_queue_.size();
+        outbound_count_--;
+        outbound_dropped_++;
+        std::cout << "Outbound queue full, dropped oldest message" << std::endl;
     }
-    else if(msg.command == "USBLPHYD")
+    outbound_queue_[(outbound_head_ + outbound_count_) % outbound_queue_.size()].assign(s);
+    outbound_count_++;
+}
+
+void goby::acomms::EvologicsDriver::flush_outbound_queue()
+{
+    while (outbound_count_ > 0 && link_state_ == LinkState::CONNECTED)
     {
-        UsblPhydMsg phyd;
-        phyd.current_time = std::stof(msg.data[0]);
-        phyd.measurement_time = std::stof(msg.data[1]);
-        phyd.remote_address = std::stoi(msg.data[2]);
-        phyd.fix_type = std::stoi(msg.data[3]);
-        phyd.delay_1_5 = std::stoi(msg.data[4]);
-        phyd.delay_2_5 = std::stoi(msg.data[5]);
-        phyd.delay_3_5 = std::stoi(msg.data[6]);
-        phyd.delay_4_5 = std::stoi(msg.data[7]);
-        phyd.delay_1_2 = std::stoi(msg.data[8]);
-        phyd.delay_4_1 = std::stoi(msg.data[9]);
-        phyd.delay_3_2 = std::stoi(msg.data[10]);
-        phyd.delay_3_4 = std::stoi(msg.data[11]);
-
-        if(phyd_callback_)
+        try
         {
-            phyd_callback_(phyd);
+            modem_write(outbound_queue_[outbound_head_]);
+            outbound_head_ = (outbound_head_ + 1) % outbound_queue_.size();
+            outbound_count_--;
+        }
+        catch (ModemDriverException& e)
+        {
+            link_lost(e.what());
         }
     }
+}
+
+void goby::acomms::EvologicsDriver::config_write(const std::string &s)
+{
+    raw_out_.set_raw(s);
+                            
+    signal_raw_outgoing(raw_out_);
+
+    if (!fixed_memory_)
+        std::cout << "TX: " << s << std::endl;
+
+    protocol_.frame_command(raw_out_.raw(), &tx_line_);
+    link_write(tx_line_);
+}
+
+void goby::acomms::EvologicsDriver::set_usbl_targets(const std::vector<int>& addresses)
+{
+    usbl_scheduler_.set_targets(addresses, steady_time());
+}
+
+std::vector<goby::acomms::EvologicsUsblScheduler::TargetStats>
+goby::acomms::EvologicsDriver::usbl_target_stats() const
+{
+    return usbl_scheduler_.stats(steady_time());
+}
 
+void goby::acomms::EvologicsDriver::send_usbl_ping(int address)
+{
+    usbl_ping_.data[1] = std::to_string(address);
+    protocol_.encode(usbl_ping_);
+}
+
+uint16_t goby::acomms::EvologicsDriver::bulk_send(const std::string& data)
+{
+    return bulk_.send(data, steady_time());
+}
+
+bool goby::acomms::EvologicsDriver::bulk_send_file(const std::string& path, uint16_t* id)
+{
+    return bulk_.send_file(path, steady_time(), id);
+}
+
+bool goby::acomms::EvologicsDriver::bulk_progress(uint16_t id,
+                                                  EvologicsBulkTransfer::Progress* progress) const
+{
+    return bulk_.progress(id, steady_time(), progress);
+}
+
+double goby::acomms::EvologicsDriver::steady_time() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void goby::acomms::EvologicsDriver::on_usbllong(const UsbllongMsg& usbl)
+{
+    // propogation_time is reported in microseconds
+    usbl_scheduler_.on_fix(usbl.remote_address, steady_time(), usbl.propogation_time * 1e-6);
+
+    if (usbl_shm_.is_open())
+    {
+        EvologicsUsblFix fix{};
+        fix.type = EvologicsUsblFix::USBLLONG;
+        fix.remote_address = usbl.remote_address;
+        fix.current_time = usbl.current_time;
+        fix.measurement_time = usbl.measurement_time;
+        fix.host_measurement_time = usbl.host_measurement_time;
+        fix.x = usbl.xyz.x;
+        fix.y = usbl.xyz.y;
+        fix.z = usbl.xyz.z;
+        fix.e = usbl.enu.e;
+        fix.n = usbl.enu.n;
+        fix.u = usbl.enu.u;
+        fix.roll = usbl.rpy.roll;
+        fix.pitch = usbl.rpy.pitch;
+        fix.yaw = usbl.rpy.yaw;
+        fix.propogation_time = usbl.propogation_time;
+        fix.rssi = usbl.rssi;
+        fix.integrity = usbl.integrity;
+        fix.accuracy = usbl.accuracy;
+        usbl_shm_.publish(fix);
+    }
+
+    if(usbl_callback_)
+    {
+        usbl_callback_(usbl);
+    }
+}
+
+void goby::acomms::EvologicsDriver::on_usbl_angles(const UsblAnglesMsg& angles)
+{
+    usbl_scheduler_.on_fix(angles.remote_address, steady_time(), -1);
+
+    if (usbl_shm_.is_open())
+    {
+        EvologicsUsblFix fix{};
+        fix.type = EvologicsUsblFix::USBLANGLES;
+        fix.remote_address = angles.remote_address;
+        fix.current_time = angles.current_time;
+        fix.measurement_time = angles.measurement_time;
+        fix.host_measurement_time = angles.host_measurement_time;
+        fix.local_bearing = angles.local_bearing;
+        fix.local_elevation = angles.local_elevation;
+        fix.bearing = angles.bearing;
+        fix.elevation = angles.elevation;
+        fix.roll = angles.roll;
+        fix.pitch = angles.pitch;
+        fix.yaw = angles.yaw;
+        fix.rssi = angles.rssi;
+        fix.integrity = angles.integrity;
+        fix.accuracy = angles.accuracy;
+        usbl_shm_.publish(fix);
+    }
+
+    if(angles_callback_)
+    {
+        angles_callback_(angles);
+    }
+}
+
+void goby::acomms::EvologicsDriver::process_at_receive(const std::string& in)
+{
+    // replies to our own commands: +++AT<command>:<length>:<payload>
+    size_t length_index = in.find(':', 5);
+    if (length_index == std::string::npos)
+        return;
+    size_t payload_index = in.find(':', length_index + 1);
+    if (payload_index == std::string::npos)
+        return;
+
+    std::string command = in.substr(5, length_index - 5);
+    std::string payload = in.substr(payload_index + 1);
+
+    commands_.on_reply(command, payload.find("ERROR") == std::string::npos);
+
+    EvologicsSetting setting;
+    if (!EvologicsSettings::from_command(command, &setting))
+        return;
+
+    if (command[0] == '?')
+    {
+        settings_.set_read_pending(setting, false);
+
+        char* end = nullptr;
+        long value = std::strtol(payload.c_str(), &end, 10);
+        if (end != payload.c_str() && *end == '\0')
+            settings_.set_value(setting, value);
+        else
+            settings_.invalidate(setting);
+
+        sync_setting(setting);
+
+        // data frames held behind the setting writes can follow them now
+        if (!settings_.writes_held())
+            flush_outbound_queue();
+
+        if (!settings_.reads_outstanding())
+            save_settings_cache();
+    }
+    else if (payload.find("ERROR") != std::string::npos)
+    {
+        std::cout << "Modem rejected " << command << ": " << payload << std::endl;
+        settings_.invalidate(setting);
+    }
 }
 
 void goby::acomms::EvologicsDriver::signal_receive_and_clear(protobuf::ModemTransmission* message)
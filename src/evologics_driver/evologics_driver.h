@@ -8,21 +8,29 @@
 #ifndef GOBY_ACOMMS_MODEMDRIVER_EVO_DRIVER_H
 #define GOBY_ACOMMS_MODEMDRIVER_EVO_DRIVER_H
 
+#include <chrono>  // for steady_clock
 #include <cstdint> // for uint32_t
 #include <deque>    // for deque
+#include <future>   // for future
 #include <map>      // for map
 #include <memory>   // for unique_ptr
 #include <mutex>    // for mutex
 #include <set>      // for set
 #include <string>   // for string
+#include <vector>   // for vector
 
 #include "goby/acomms/modemdriver/driver_base.h"    // for ModemDriverBase
 #include "goby/acomms/protobuf/driver_base.pb.h"    // for DriverConfig
 #include "goby/acomms/protobuf/modem_message.pb.h"  // for ModemTransmission
 #include "goby/time/system_clock.h"                 // for SystemClock, Sys...
 
-#include "HayesAtEncoder.h"
-#include "HayesAtDecoder.h"
+#include "evologics_bulk_transfer.h"
+#include "evologics_command_queue.h"
+#include "evologics_compression.h"
+#include "evologics_protocol.h"
+#include "evologics_settings.h"
+#include "evologics_usbl_scheduler.h"
+#include "evologics_usbl_shm.h"
 #include <boost/regex.hpp>
 #include <boost/algorithm/string_regex.hpp>
 
@@ -41,74 +49,14 @@ namespace acomms
 class EvologicsDriver : public ModemDriverBase
 {
   public:
-      struct XYZ
-  {
-      float x;
-      float y;
-      float z;
-  };
-
-  struct ENU
-  {
-      float e;
-      float n;
-      float u;
-  };
-
-  struct RPY
-  {
-      float roll;
-      float pitch;
-      float yaw;
-  };
-
-  struct UsbllongMsg
-  {
-      double current_time;
-      double measurement_time;
-      int remote_address;
-      XYZ xyz;
-      ENU enu;
-      RPY rpy;
-      float propogation_time;
-      int rssi;
-      int integrity;
-      float accuracy;
-  };
-
-  struct UsblAnglesMsg
-  {
-    float current_time;
-    float measurement_time;
-    int remote_address;
-    float local_bearing;
-    float local_elevation;
-    float bearing;
-    float elevation;
-    float roll;
-    float pitch;
-    float yaw;
-    float rssi;
-    float integrity;
-    float accuracy;
-  };
-
-  struct UsblPhydMsg
-  {
-    float current_time;
-    float measurement_time;
-    int remote_address;
-    bool fix_type;
-    int delay_1_5;
-    int delay_2_5;
-    int delay_3_5;
-    int delay_4_5;
-    int delay_1_2;
-    int delay_4_1;
-    int delay_3_2;
-    int delay_3_4;
-  };
-
+    typedef EvologicsProtocol::XYZ XYZ;
+    typedef EvologicsProtocol::ENU ENU;
+    typedef EvologicsProtocol::RPY RPY;
+    typedef EvologicsProtocol::UsbllongMsg UsbllongMsg;
+    typedef EvologicsProtocol::UsblAnglesMsg UsblAnglesMsg;
+    typedef EvologicsProtocol::UsblPhydMsg UsblPhydMsg;
+    typedef EvologicsCommandQueue::Result CommandResult;
+    typedef EvologicsCommandQueue::Handle CommandHandle;
 
     typedef std::function<void(UsbllongMsg)> UsblCallback;
     UsblCallback usbl_callback_;
@@ -122,6 +70,24 @@ class EvologicsDriver : public ModemDriverBase
     typedef std::function<void(UsblPhydMsg)> PhydCallback;
     PhydCallback phyd_callback_;
 
+    typedef std::function<void(bool)> ConnectionCallback;
+    ConnectionCallback connection_callback_;
+
+    typedef std::function<void(hayes::AtStatus, const std::string&)> DecodeErrorCallback;
+    DecodeErrorCallback decode_error_callback_;
+
+    typedef std::function<void(const std::string&, const std::string&)> NotificationCallback;
+    NotificationCallback notification_callback_;
+
+
+    /// \brief Buffer sizes for the fixed memory mode, see set_fixed_memory().
+    struct FixedMemoryConfig
+    {
+        // longest line (data frame or AT line) the modem will send or be sent, including delimiters
+        size_t max_line_bytes{1100};
+        // most comma separated fields in one notification
+        size_t max_fields{32};
+    };
 
     /// \brief Default constructor.
     EvologicsDriver();
@@ -147,43 +113,81 @@ class EvologicsDriver : public ModemDriverBase
 
     bool is_started() const { return startup_done_; }
 
-    void extended_notification_on();
+    // The setters below and submit_*() may be called from any thread. They are queued
+    // and issued by the first do_work() with the link up, and the handle completes when
+    // the modem replies.
+
+    CommandHandle extended_notification_on();
+
+    CommandHandle extended_notification_off();
+
+    CommandHandle set_source_level(int source_level);
+
+    CommandHandle set_source_control(int source_control);
+
+    CommandHandle set_gain(int gain);
 
-    void extended_notification_off();
+    CommandHandle set_carrier_waveform_id(int id);
 
-    void set_source_level(int source_level);
+    CommandHandle set_local_address(int address);
 
-    void set_source_control(int source_control);
+    CommandHandle set_remote_address(int address);
 
-    void set_gain(int gain);
+    CommandHandle set_highest_address(int address);
 
-    void set_carrier_waveform_id(int id);
+    CommandHandle set_cluster_size(int size);
 
-    void set_local_address(int address);
+    CommandHandle set_packet_time(int time);
 
-    void set_remote_address(int address);
+    CommandHandle set_retry_count(int count);
 
-    void set_highest_address(int address);
+    CommandHandle set_retry_timeout(int time);
 
-    void set_cluster_size(int size);
+    CommandHandle set_keep_online_count(int count);
 
-    void set_packet_time(int time);
+    CommandHandle set_idle_timeout(int time);
 
-    void set_retry_count(int count);
+    CommandHandle set_channel_protocol_id(int id);
 
-    void set_retry_timeout(int time);
+    CommandHandle set_sound_speed(int speed);
 
-    void set_keep_online_count(int count);
+    CommandHandle save_settings();
 
-    void set_idle_timeout(int time);
+    CommandHandle factory_reset();
 
-    void set_channel_protocol_id(int id);
+    /// \brief Queue a setting write. Several writes of a setting queued in one tick are sent
+    /// once with the last value, the others complete as SUPERSEDED.
+    CommandHandle submit_setting(EvologicsSetting setting, int value)
+    {
+        return commands_.submit_setting(setting, value);
+    }
 
-    void set_sound_speed(int speed);
+    /// \brief Queue an AT command, without the AT prefix. With coalesce, one queued in the
+    /// same tick as another of the same name (e.g. "@ZX0" and "@ZX1") replaces it.
+    CommandHandle submit_command(const std::string& command, bool coalesce = false)
+    {
+        return commands_.submit_command(command, coalesce);
+    }
 
-    void save_settings();
+    /// \brief Seconds a queued command waits for the modem's reply before completing as TIMEOUT.
+    void set_command_reply_timeout(double seconds) { commands_.set_reply_timeout(seconds); }
 
-    void factory_reset();
+    /// \brief Writes a setting now, only if it differs from the value known to be on the modem.
+    /// Unlike set_gain() etc. this must be called from the thread that calls do_work().
+    void set_setting(EvologicsSetting setting, int value);
+
+    /// \brief Applies a desired-state profile, sending only the settings that differ.
+    void apply_settings(const EvologicsSettingsProfile& profile);
+
+    /// \brief Requests the current value of every known setting from the modem in one batch.
+    void read_settings();
+
+    /// \brief Last value known to be on the modem. False if it has not been read or written yet.
+    bool get_setting(EvologicsSetting setting, int* value) const { return settings_.value(setting, value); }
+
+    /// \brief File used to persist the desired settings between runs, they are re-applied
+    /// once the startup read shows what the modem has. Set before startup().
+    void set_settings_cache_file(const std::string& path) { settings_cache_file_ = path; }
 
     void set_usbl_callback(UsblCallback c) { usbl_callback_  = c;}
 
@@ -193,11 +197,122 @@ class EvologicsDriver : public ModemDriverBase
 
     void set_phyd_callback(PhydCallback c){ phyd_callback_ = c;}
 
+    /// \brief Called with false when the link to the modem is lost and true once it is re-established.
+    void set_connection_callback(ConnectionCallback c){ connection_callback_ = c;}
+
+    /// \brief Delay before the first reconnect attempt, doubled after each failure up to max.
+    void set_reconnect_backoff(std::chrono::milliseconds initial, std::chrono::milliseconds max)
+    {
+        reconnect_backoff_initial_ = initial;
+        reconnect_backoff_max_ = max;
+        reconnect_backoff_ = initial;
+    }
+
+    /// \brief Number of frames and commands held while the link is down. The oldest is dropped when full.
+    /// Call before startup(), anything already queued is discarded.
+    void set_outbound_queue_size(size_t size);
+
+    /// \brief Size every buffer, message slot and queue at startup() so the steady state
+    /// receive and transmit paths do not allocate. Call before startup().
+    void set_fixed_memory(const FixedMemoryConfig& cfg)
+    {
+        fixed_memory_ = true;
+        fixed_memory_cfg_ = cfg;
+    }
+
+    /// \brief Bytes preallocated by the fixed memory mode, the driver's bound on its own buffers.
+    size_t fixed_memory_bytes() const;
+
+    /// \brief Probe the modem after this long without input and drop the link if the probe goes unanswered.
+    /// A peer that vanishes without closing the connection is only noticed this way. 30 s by default, zero disables.
+    void set_link_timeout(std::chrono::seconds timeout) { link_timeout_ = timeout; }
+
+    /// \brief Called with the category and raw bytes of every line that fails to decode.
+    void set_decode_error_callback(DecodeErrorCallback c) { decode_error_callback_ = c; }
+
+    /// \brief Called with the name and raw line of every notification from the modem, e.g. ("USBLLONG", "+++AT:..").
+    void set_notification_callback(NotificationCallback c) { notification_callback_ = c; }
+
+    /// \brief Number of lines that failed to decode with the given status since construction.
+    uint64_t decode_error_count(hayes::AtStatus status) const
+    {
+        return protocol_.decode_error_count(status);
+    }
+
+    /// \brief Also publish every USBLLONG/USBLANGLES fix to the shared memory ring /name, opened at startup().
+    /// Other processes read it with EvologicsUsblShmReader.
+    void set_usbl_shm(const std::string& name, size_t capacity = 256)
+    {
+        usbl_shm_name_ = name;
+        usbl_shm_capacity_ = capacity;
+    }
+
+    /// \brief Compress data frames once the peer has offered compression too. Call before startup().
+    void set_compression(bool enabled) { compression_.set_enabled(enabled); }
+
+    /// \brief Preset dictionary for compression, the peer must load the same file under the same id.
+    bool load_compression_dictionary(int id, const std::string& path)
+    {
+        return compression_.load_dictionary(id, path);
+    }
+
+    /// \brief Frames compressed and sent raw, achieved ratio and time spent coding.
+    const EvologicsCompression::Stats& compression_stats() const { return compression_.stats(); }
+
+    /// \brief Queue a buffer to be sent in segments with a sliding window and selective
+    /// acknowledgements. Returns the transfer id. Transfers are buffered in full, outside
+    /// the fixed memory bound.
+    uint16_t bulk_send(const std::string& data);
+
+    /// \brief Queue the contents of a file as a bulk transfer.
+    bool bulk_send_file(const std::string& path, uint16_t* id);
+
+    /// \brief Progress and goodput of an outgoing bulk transfer.
+    bool bulk_progress(uint16_t id, EvologicsBulkTransfer::Progress* progress) const;
+
+    void set_bulk_config(const EvologicsBulkTransfer::Config& cfg) { bulk_.set_config(cfg); }
+
+    /// \brief Called with each completed incoming bulk transfer.
+    void set_bulk_receive_callback(EvologicsBulkTransfer::ReceiveCallback c)
+    {
+        bulk_.set_receive_callback(c);
+    }
+
+    /// \brief Called as acknowledgements move an outgoing bulk transfer on.
+    void set_bulk_progress_callback(EvologicsBulkTransfer::ProgressCallback c)
+    {
+        bulk_.set_progress_callback(c);
+    }
+
+    /// \brief Interrogate these remote addresses in turn with instant message pings,
+    /// packed as tightly as each target's last measured range allows. Empty stops.
+    void set_usbl_targets(const std::vector<int>& addresses);
+
+    void set_usbl_scheduler_config(const EvologicsUsblScheduler::Config& cfg)
+    {
+        usbl_scheduler_.set_config(cfg);
+    }
+
+    /// \brief Pings, fixes and achieved fix rate for each USBL target.
+    std::vector<EvologicsUsblScheduler::TargetStats> usbl_target_stats() const;
+
+    /// \brief Modem to host clock model, fed from the timestamps in every USBL notification.
+    const EvologicsClock& modem_clock() const { return protocol_.clock(); }
+
+    bool is_connected() const { return link_state_ == LinkState::CONNECTED; }
+
+    /// \brief Lines held in the outbound queue (behind a settings read, or while the link is
+    /// down) and not yet written to the modem.
+    size_t outbound_queued() const { return outbound_count_; }
+
+    size_t outbound_queue_dropped() const { return outbound_dropped_; }
+
 
     // output
     void evologics_write(const std::string &s); // actually write a message
     void config_write(const std::string &s); // actually write a message
-    void on_decode(const hayes::AtMsg msg);
+    void on_usbllong(const UsbllongMsg& usbl);
+    void on_usbl_angles(const UsblAnglesMsg& angles);
     void data_transmission(protobuf::ModemTransmission *msg);
 
     // input
@@ -209,9 +324,6 @@ class EvologicsDriver : public ModemDriverBase
     
 
   private:
-    // for the serial connection
-    std::string buffer_;
-
     std::string DEFAULT_TCP_SERVER = "192.168.0.209";
     int DEFAULT_TCP_PORT = 9200;
     int DEFAULT_BAUD = 19200;
@@ -233,8 +345,86 @@ class EvologicsDriver : public ModemDriverBase
     // DCCL requires full memory barrier...
     static std::mutex dccl_mutex_;
 
-    hayes::AtEncoder encoder_;
-    hayes::AtDecoder decoder_;
+    // framing, parsing and command building
+    EvologicsProtocol protocol_;
+
+    // model of the modem settings, so setters only write what changes
+    EvologicsSettings settings_;
+    std::string settings_cache_file_;
+    std::chrono::steady_clock::time_point settings_read_start_;
+    // give up waiting on reads the modem never answers
+    const std::chrono::seconds SETTINGS_READ_TIMEOUT{5};
+
+    void sync_setting(EvologicsSetting setting);
+
+    // control commands from other threads, issued by do_work() and before every data frame
+    EvologicsCommandQueue commands_;
+    std::vector<EvologicsCommandQueue::Command> drained_commands_;
+    void issue_commands();
+    void save_settings_cache();
+
+    // connection health and reconnect
+    enum class LinkState
+    {
+        CONNECTED,
+        DISCONNECTED,
+        RECONNECTING
+    };
+    LinkState link_state_{LinkState::DISCONNECTED};
+    std::future<bool> reconnect_future_;
+    std::chrono::steady_clock::time_point next_reconnect_;
+    std::chrono::milliseconds reconnect_backoff_initial_{500};
+    std::chrono::milliseconds reconnect_backoff_max_{30000};
+    std::chrono::milliseconds reconnect_backoff_{500};
+
+    std::chrono::seconds link_timeout_{30};
+    std::chrono::steady_clock::time_point last_rx_;
+    std::chrono::steady_clock::time_point probe_time_;
+    bool probe_sent_{false};
+
+    // written out in order once the link is back, a ring so it can be preallocated
+    std::vector<std::string> outbound_queue_;
+    size_t outbound_head_{0};
+    size_t outbound_count_{0};
+    size_t outbound_dropped_{0};
+
+    // reused on every read and write so the steady state does not allocate
+    bool fixed_memory_{false};
+    FixedMemoryConfig fixed_memory_cfg_;
+    std::string rx_line_;
+    std::string tx_line_;
+    // the line handed to the notification and decode error callbacks
+    std::string callback_line_;
+    protobuf::ModemRaw raw_in_;
+    protobuf::ModemRaw raw_out_;
+    void reserve_fixed_memory();
+
+    std::string usbl_shm_name_;
+    size_t usbl_shm_capacity_{256};
+    EvologicsUsblShmWriter usbl_shm_;
+
+    EvologicsCompression compression_;
+    std::string compressed_tx_;
+    std::string compressed_rx_;
+    void send_compression_offer();
+
+    EvologicsBulkTransfer bulk_;
+    // through compression (or at least its escape), like frames from the MAC
+    void write_data_frame(const std::string& frame);
+
+    // multi target interrogation, the ping message is reused so it does not allocate
+    EvologicsUsblScheduler usbl_scheduler_;
+    hayes::AtMsg usbl_ping_;
+    void send_usbl_ping(int address);
+    // monotonic seconds for the scheduler and bulk transfers
+    double steady_time() const;
+
+    bool check_link();
+    void link_lost(const std::string& reason);
+    bool link_read(std::string* s);
+    void link_write(const std::string& s);
+    void queue_outbound(const std::string& s);
+    void flush_outbound_queue();
 
 
 
@@ -0,0 +1,243 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#include <climits>       // for INT_MAX
+#include <cstring>       // for memcpy
+#include <fcntl.h>       // for O_CREAT, O_RDWR
+#include <linux/futex.h> // for FUTEX_WAIT, FUTEX_WAKE
+#include <sys/mman.h>    // for shm_open, mmap
+#include <sys/stat.h>    // for fstat
+#include <sys/syscall.h> // for SYS_futex
+#include <time.h>        // for timespec
+#include <unistd.h>      // for ftruncate, syscall
+
+#include "evologics_usbl_shm.h"
+
+namespace
+{
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory atomics must be lock free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory atomics must be lock free");
+
+std::string shm_path(const std::string& name) { return name.empty() || name[0] != '/' ? "/" + name : name; }
+
+uint32_t* futex_word(const std::atomic<uint32_t>& a)
+{
+    return reinterpret_cast<uint32_t*>(const_cast<std::atomic<uint32_t>*>(&a));
+}
+} // namespace
+
+namespace goby
+{
+namespace acomms
+{
+
+EvologicsUsblShmWriter::EvologicsUsblShmWriter()
+{
+}
+
+EvologicsUsblShmWriter::~EvologicsUsblShmWriter() { close(); }
+
+bool EvologicsUsblShmWriter::open(const std::string& name, size_t capacity)
+{
+    close();
+
+    if (capacity == 0)
+        return false;
+
+    int fd = shm_open(shm_path(name).c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    size_t size = sizeof(EvologicsUsblShmHeader) + capacity * sizeof(EvologicsUsblShmSlot);
+    if (ftruncate(fd, size) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    map_size_ = size;
+    header_ = static_cast<EvologicsUsblShmHeader*>(map);
+    slots_ = reinterpret_cast<EvologicsUsblShmSlot*>(header_ + 1);
+
+    // readers check the magic last, so invalidate it while the layout changes
+    header_->magic = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    header_->version = EvologicsUsblShmHeader::VERSION;
+    header_->capacity = capacity;
+    header_->slot_size = sizeof(EvologicsUsblShmSlot);
+    header_->write_index.store(0, std::memory_order_relaxed);
+    header_->notify.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < capacity; i++) slots_[i].seq.store(0, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = EvologicsUsblShmHeader::MAGIC;
+
+    return true;
+}
+
+void EvologicsUsblShmWriter::close()
+{
+    if (!header_)
+        return;
+
+    // the segment is left in place for readers that are still attached
+    munmap(header_, map_size_);
+    header_ = nullptr;
+    slots_ = nullptr;
+    map_size_ = 0;
+}
+
+void EvologicsUsblShmWriter::publish(const EvologicsUsblFix& fix)
+{
+    if (!header_)
+        return;
+
+    uint64_t index = header_->write_index.load(std::memory_order_relaxed);
+    EvologicsUsblShmSlot& slot = slots_[index % header_->capacity];
+
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&slot.fix, &fix, sizeof(fix));
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+
+    header_->write_index.store(index + 1, std::memory_order_release);
+
+    header_->notify.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, futex_word(header_->notify), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+EvologicsUsblShmReader::EvologicsUsblShmReader()
+{
+}
+
+EvologicsUsblShmReader::~EvologicsUsblShmReader() { close(); }
+
+bool EvologicsUsblShmReader::open(const std::string& name)
+{
+    close();
+
+    int fd = shm_open(shm_path(name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(EvologicsUsblShmHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    map_size_ = st.st_size;
+    header_ = static_cast<const EvologicsUsblShmHeader*>(map);
+    slots_ = reinterpret_cast<const EvologicsUsblShmSlot*>(header_ + 1);
+
+    bool valid = header_->magic == EvologicsUsblShmHeader::MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid = valid && header_->version == EvologicsUsblShmHeader::VERSION &&
+            header_->slot_size == sizeof(EvologicsUsblShmSlot) && header_->capacity > 0 &&
+            map_size_ >= sizeof(EvologicsUsblShmHeader) + header_->capacity * sizeof(EvologicsUsblShmSlot);
+    if (!valid)
+    {
+        close();
+        return false;
+    }
+
+    next_index_ = header_->write_index.load(std::memory_order_acquire);
+    lost_ = 0;
+    return true;
+}
+
+void EvologicsUsblShmReader::close()
+{
+    if (!header_)
+        return;
+
+    munmap(const_cast<EvologicsUsblShmHeader*>(header_), map_size_);
+    header_ = nullptr;
+    slots_ = nullptr;
+    map_size_ = 0;
+}
+
+bool EvologicsUsblShmReader::poll(EvologicsUsblFix* fix)
+{
+    if (!header_)
+        return false;
+
+    uint64_t write_index = header_->write_index.load(std::memory_order_acquire);
+    uint64_t capacity = header_->capacity;
+
+    // the writer was restarted
+    if (write_index < next_index_)
+        next_index_ = write_index;
+
+    if (write_index - next_index_ > capacity)
+    {
+        lost_ += write_index - capacity - next_index_;
+        next_index_ = write_index - capacity;
+    }
+
+    while (next_index_ < write_index)
+    {
+        const EvologicsUsblShmSlot& slot = slots_[next_index_ % capacity];
+        uint64_t expected = 2 * next_index_ + 2;
+
+        if (slot.seq.load(std::memory_order_acquire) == expected)
+        {
+            std::memcpy(fix, &slot.fix, sizeof(*fix));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == expected)
+            {
+                next_index_++;
+                return true;
+            }
+        }
+
+        // the writer lapped us while we were reading this slot
+        lost_++;
+        next_index_++;
+    }
+    return false;
+}
+
+bool EvologicsUsblShmReader::wait(EvologicsUsblFix* fix, std::chrono::milliseconds timeout)
+{
+    if (!header_)
+        return false;
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        // read the futex word before polling so a publish in between wakes us
+        uint32_t notify = header_->notify.load(std::memory_order_acquire);
+        if (poll(fix))
+            return true;
+
+        auto remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero())
+            return false;
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+        timespec ts;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        syscall(SYS_futex, futex_word(header_->notify), FUTEX_WAIT, notify, &ts, nullptr, 0);
+    }
+}
+
+} // namespace acomms
+} // namespace goby
@@ -0,0 +1,132 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+#ifndef EVOLOGICS_USBL_SHM_H
+#define EVOLOGICS_USBL_SHM_H
+
+#include <atomic>  // for atomic
+#include <chrono>  // for milliseconds
+#include <cstddef> // for size_t
+#include <cstdint> // for uint32_t, uint64_t
+#include <string>  // for string
+
+namespace goby
+{
+namespace acomms
+{
+/// \brief One USBL fix as laid out in shared memory. Plain data, no pointers.
+struct EvologicsUsblFix
+{
+    enum Type : uint32_t
+    {
+        USBLLONG = 1,
+        USBLANGLES = 2
+    };
+
+    uint32_t type;
+    int32_t remote_address;
+    double current_time;
+    double measurement_time;
+    double host_measurement_time;
+
+    // USBLLONG
+    float x, y, z;
+    float e, n, u;
+    float propogation_time;
+
+    // USBLANGLES
+    float local_bearing;
+    float local_elevation;
+    float bearing;
+    float elevation;
+
+    // both
+    float roll, pitch, yaw;
+    float rssi;
+    float integrity;
+    float accuracy;
+};
+
+/// \brief Shared memory layout: a header followed by capacity slots, each guarded by its own seqlock.
+struct EvologicsUsblShmHeader
+{
+    static constexpr uint32_t MAGIC = 0x4c425355; // "USBL"
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t slot_size;
+    // index of the next fix to be written
+    std::atomic<uint64_t> write_index;
+    // futex word bumped on every publish so readers can sleep
+    std::atomic<uint32_t> notify;
+};
+
+struct EvologicsUsblShmSlot
+{
+    // 2 * index + 1 while being written, 2 * index + 2 once complete
+    std::atomic<uint64_t> seq;
+    EvologicsUsblFix fix;
+};
+
+/// \class EvologicsUsblShmWriter evologics_usbl_shm.h
+/// \brief Publishes fixes into a POSIX shared memory ring. Never waits on readers.
+class EvologicsUsblShmWriter
+{
+  public:
+    EvologicsUsblShmWriter();
+    ~EvologicsUsblShmWriter();
+
+    /// \brief Create (or take over) the segment /name with room for capacity fixes.
+    bool open(const std::string& name, size_t capacity);
+    void close();
+    bool is_open() const { return header_ != nullptr; }
+
+    void publish(const EvologicsUsblFix& fix);
+
+  private:
+    EvologicsUsblShmHeader* header_{nullptr};
+    EvologicsUsblShmSlot* slots_{nullptr};
+    size_t map_size_{0};
+};
+
+/// \class EvologicsUsblShmReader evologics_usbl_shm.h
+/// \brief Reads fixes from a ring created by EvologicsUsblShmWriter, from any process on the host.
+///
+/// The segment is mapped read only. A reader that falls more than a ring behind
+/// skips ahead to the oldest fix still available and counts the rest as lost.
+class EvologicsUsblShmReader
+{
+  public:
+    EvologicsUsblShmReader();
+    ~EvologicsUsblShmReader();
+
+    /// \brief Attach to the segment /name. Only fixes published after this call are returned.
+    bool open(const std::string& name);
+    void close();
+    bool is_open() const { return header_ != nullptr; }
+
+    /// \brief Copy out the next fix if one is available, without blocking.
+    bool poll(EvologicsUsblFix* fix);
+
+    /// \brief As poll(), but sleep until a fix is published or timeout expires.
+    bool wait(EvologicsUsblFix* fix, std::chrono::milliseconds timeout);
+
+    /// \brief Fixes overwritten before this reader got to them.
+    uint64_t lost() const { return lost_; }
+
+  private:
+    const EvologicsUsblShmHeader* header_{nullptr};
+    const EvologicsUsblShmSlot* slots_{nullptr};
+    size_t map_size_{0};
+    uint64_t next_index_{0};
+    uint64_t lost_{0};
+};
+} // namespace acomms
+} // namespace goby
+#endif
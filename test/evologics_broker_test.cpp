@@ -0,0 +1,161 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+// Runs the broker over the driver built against the goby stub in test/goby_stub, with one
+// client on its socket. Fails if TX accepts anything but an even number of hex digits, if
+// frames are handed to the driver while it holds one back behind a settings read, or if the
+// frame after a held one waits for more than its SENDEND.
+
+#include <chrono>       // for milliseconds
+#include <cstdio>       // for printf
+#include <string>       // for string, to_string
+#include <sys/socket.h> // for socket, connect, send, recv
+#include <sys/un.h>     // for sockaddr_un
+#include <thread>       // for sleep_for
+#include <unistd.h>     // for close, getpid
+
+#include "evologics_broker.h"
+
+using goby::acomms::EvologicsBroker;
+using goby::acomms::EvologicsDriver;
+using goby::acomms::EvologicsSetting;
+using goby::acomms::EvologicsSettings;
+
+namespace
+{
+bool failed = false;
+
+void check(bool ok, const char* what)
+{
+    std::printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+        failed = true;
+}
+
+std::string notification(const std::string& body)
+{
+    return "+++AT:" + std::to_string(body.size()) + ":" + body + "\r\n";
+}
+
+std::string reply(const std::string& command, const std::string& payload)
+{
+    return "+++AT" + command + ":" + std::to_string(payload.size()) + ":" + payload + "\r\n";
+}
+
+// data lines written to the modem that carry frame
+int written(const EvologicsDriver& driver, const std::string& frame)
+{
+    int n = 0;
+    for (const std::string& line : driver.tx_lines)
+    {
+        if (line.compare(0, frame.size(), frame) == 0)
+            n++;
+    }
+    return n;
+}
+
+struct Client
+{
+    int fd{-1};
+    std::string in;
+
+    bool connect_to(const std::string& path)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+        return fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    }
+
+    void send_line(const std::string& line)
+    {
+        std::string s = line + "\n";
+        send(fd, s.data(), s.size(), 0);
+    }
+
+    // the next line from the broker, once do_work() has run
+    std::string line(EvologicsBroker& broker)
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            broker.do_work();
+            char buf[1024];
+            ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n > 0)
+                in.append(buf, n);
+
+            size_t end = in.find('\n');
+            if (end != std::string::npos)
+            {
+                std::string l = in.substr(0, end);
+                in.erase(0, end + 1);
+                return l;
+            }
+        }
+        return "";
+    }
+};
+} // namespace
+
+int main()
+{
+    EvologicsDriver driver;
+    // written once the settings are read back, so data frames queue behind it until then
+    driver.set_setting(EvologicsSetting::GAIN, 1);
+
+    goby::acomms::protobuf::DriverConfig cfg;
+    cfg.set_connection_type(goby::acomms::protobuf::DriverConfig::CONNECTION_TCP_AS_CLIENT);
+    driver.startup(cfg);
+
+    EvologicsBroker broker(driver);
+    broker.set_transmit_timeout(std::chrono::milliseconds(200));
+    std::string path = "/tmp/evologics_broker_test." + std::to_string(getpid());
+    check(broker.open(path), "broker listens");
+
+    Client client;
+    check(client.connect_to(path), "client connects");
+
+    for (const char* bad : {"TX zz", "TX 414", "TX 41-2", "TX"})
+    {
+        client.send_line(bad);
+        check(client.line(broker).compare(0, 6, "ERR TX") == 0, bad);
+    }
+
+    client.send_line("TX 4142");
+    check(client.line(broker) == "OK TX 1", "first frame queued");
+    client.send_line("TX 4344");
+    // the first is with the driver by now
+    check(client.line(broker) == "OK TX 1", "second frame queued");
+
+    // longer than the transmit timeout, which only starts once the frame is written
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    for (int i = 0; i < 10; i++) broker.do_work();
+    check(driver.outbound_queued() == 1 && written(driver, "AB") == 0,
+          "first frame held by the driver behind the settings read");
+    check(written(driver, "CD") == 0 && driver.outbound_queued() == 1,
+          "second frame kept by the broker meanwhile");
+
+    // the read completes, the gain is written and the held frame follows it
+    driver.rx_next = 0;
+    driver.rx_lines.clear();
+    for (EvologicsSetting setting : EvologicsSettings::all())
+        driver.rx_lines.push_back(reply(EvologicsSettings::query_command(setting), "0"));
+    driver.rx_lines.push_back(reply("!G1", "OK"));
+    for (int i = 0; i < 10; i++) broker.do_work();
+    check(driver.outbound_queued() == 0 && written(driver, "AB") == 1, "held frame written");
+    check(written(driver, "CD") == 0, "second frame waits for the first one's SENDEND");
+
+    driver.rx_lines.push_back(notification("SENDEND,2,100,1,2"));
+    broker.do_work();
+    broker.do_work();
+    check(written(driver, "CD") == 1, "second frame sent on SENDEND");
+
+    broker.close();
+    close(client.fd);
+    return failed ? 1 : 0;
+}
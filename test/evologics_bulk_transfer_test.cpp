@@ -0,0 +1,186 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+// Runs bulk transfers between two ends over an emulated line link (frames split on "\r\n",
+// lines holding "+++" taken by the AT decoder, a trailing '\n' trimmed) that loses frames,
+// goes down for longer than the receiver's incoming_timeout, or sees the receiver restart
+// partway. Fails if a buffer arrives corrupted or not at all, or if the sender reports a
+// transfer complete that the receiver has not delivered.
+
+#include <cstdio>  // for printf
+#include <map>     // for map
+#include <memory>  // for unique_ptr
+#include <random>  // for mt19937, uniform_real_distribution
+#include <string>  // for string
+#include <vector>  // for vector
+
+#include "evologics_bulk_transfer.h"
+
+using goby::acomms::EvologicsBulkTransfer;
+
+namespace
+{
+struct Line
+{
+    std::string stream;
+    long split{0};
+
+    void write(const std::string& frame)
+    {
+        stream += frame;
+        stream += "\r\n";
+    }
+
+    template <typename Deliver> void read(Deliver deliver)
+    {
+        size_t p;
+        while ((p = stream.find("\r\n")) != std::string::npos)
+        {
+            std::string line = stream.substr(0, p);
+            stream.erase(0, p + 2);
+            if (line.find("+++") != std::string::npos)
+            {
+                split++;
+                continue;
+            }
+            if (!line.empty() && line.back() == '\n')
+                line.pop_back();
+            deliver(line);
+        }
+    }
+};
+
+struct Scenario
+{
+    const char* name;
+    double loss;
+    // link down over [down_at, up_at)
+    double down_at;
+    double up_at;
+    // the receiver restarts once the sender has this fraction of the second transfer's segments
+    // acknowledged, zero for never. It fits one acknowledgement bitmap, so the segments sent
+    // after the restart are enough for the receiver to acknowledge every one of them
+    double restart_after;
+};
+
+bool run(const Scenario& scenario, std::mt19937& rng)
+{
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    EvologicsBulkTransfer::Config cfg;
+    cfg.segment_size = 200;
+    cfg.retransmit_timeout = 20;
+    cfg.incoming_timeout = 120;
+
+    Line to_receiver, to_sender;
+    bool link_up = true;
+    auto lossy = [&](Line& line) {
+        return [&](const std::string& frame) {
+            if (link_up && uniform(rng) >= scenario.loss)
+                line.write(frame);
+        };
+    };
+
+    std::map<uint16_t, std::string> delivered;
+    long duplicates = 0;
+    std::unique_ptr<EvologicsBulkTransfer> receiver;
+    auto start_receiver = [&]() {
+        receiver.reset(new EvologicsBulkTransfer);
+        receiver->set_config(cfg);
+        receiver->set_frame_callback(lossy(to_sender));
+        receiver->set_receive_callback([&](uint16_t id, const std::string& data) {
+            if (!delivered.emplace(id, data).second)
+                duplicates++;
+        });
+    };
+    start_receiver();
+
+    long false_completions = 0;
+    EvologicsBulkTransfer sender;
+    sender.set_config(cfg);
+    sender.set_frame_callback(lossy(to_receiver));
+    sender.set_progress_callback([&](const EvologicsBulkTransfer::Progress& p) {
+        if (p.complete && !delivered.count(p.id))
+            false_completions++;
+    });
+
+    // every byte the stuffing has to deal with, and plenty of them
+    const char special[] = {'\r', '\n', '+', 0x10, '\0'};
+    std::vector<std::string> buffers(3);
+    for (int i = 0; i < 20000; i++)
+        buffers[0].push_back(rng() % 3 ? special[rng() % 5] : static_cast<char>(rng()));
+    for (int i = 0; i < 5000; i++) buffers[1].push_back(static_cast<char>(rng()));
+    buffers[2] = "abc\r\n+++\n";
+
+    std::vector<uint16_t> ids;
+    for (const std::string& b : buffers) ids.push_back(sender.send(b, 0));
+
+    bool restarted = false;
+    double t = 0;
+    for (; t < 50000 && sender.sending(); t += 0.5)
+    {
+        bool was_up = link_up;
+        link_up = t < scenario.down_at || t >= scenario.up_at;
+        if (link_up && !was_up)
+            sender.link_restored();
+
+        EvologicsBulkTransfer::Progress p;
+        if (scenario.restart_after && !restarted && sender.progress(ids[1], t, &p) &&
+            p.segments_acked >= scenario.restart_after * p.segments)
+        {
+            start_receiver();
+            restarted = true;
+        }
+
+        to_receiver.read([&](const std::string& f) {
+            if (EvologicsBulkTransfer::is_bulk_frame(f))
+                receiver->on_frame(f, t);
+        });
+        to_sender.read([&](const std::string& f) {
+            if (EvologicsBulkTransfer::is_bulk_frame(f))
+                sender.on_frame(f, t);
+        });
+        sender.do_work(t);
+        receiver->do_work(t);
+    }
+
+    bool ok = !sender.sending() && false_completions == 0 &&
+              to_receiver.split + to_sender.split == 0;
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        EvologicsBulkTransfer::Progress p;
+        auto it = delivered.find(ids[i]);
+        if (it == delivered.end() || it->second != buffers[i] || !sender.progress(ids[i], t, &p) ||
+            !p.complete)
+            ok = false;
+    }
+
+    std::printf("%s: %s after %.1f s, %zu of %zu delivered, %ld duplicates, %ld reported complete "
+                "before delivery, %ld frames split by the link\n",
+                scenario.name, ok ? "ok" : "FAIL", t, delivered.size(), buffers.size(), duplicates,
+                false_completions, to_receiver.split + to_sender.split);
+    return ok;
+}
+} // namespace
+
+int main()
+{
+    const Scenario scenarios[] = {
+        {"clear", 0, 0, 0, 0},
+        {"30% loss", 0.3, 0, 0, 0},
+        {"outage past incoming_timeout", 0, 5, 400, 0},
+        {"outage with 30% loss", 0.3, 100, 500, 0},
+        {"receiver restart", 0, 0, 0, 0.3},
+        {"receiver restart with 30% loss", 0.3, 0, 0, 0.5},
+        {"receiver restart near the end", 0, 0, 0, 0.9},
+    };
+
+    std::mt19937 rng(7);
+    bool ok = true;
+    for (const Scenario& s : scenarios) ok = run(s, rng) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+// Runs two compression ends against each other over a lossy link (0, 30 and 60% of frames
+// lost, offers included, and one end restarted halfway) and fails if a data frame arrives
+// corrupted, is taken for an offer, or the ends do not settle on compressing once the link
+// is clear again. Application frames include ones that start like offers, compressed frames
+// and bulk transfer frames.
+
+#include <cstdio>  // for printf
+#include <deque>   // for deque
+#include <random>  // for mt19937, uniform_real_distribution
+#include <string>  // for string, to_string
+
+#include "evologics_compression.h"
+
+using goby::acomms::EvologicsCompression;
+
+namespace
+{
+const std::string DICTIONARY = "telemetry depth=12.5 heading=270 speed=1.2 t=1234 telemetry depth=";
+
+struct WireFrame
+{
+    std::string wire;
+    // empty for offers
+    std::string sent;
+};
+
+struct End
+{
+    EvologicsCompression compression;
+    std::deque<WireFrame> out;
+
+    void start(double now)
+    {
+        compression = EvologicsCompression();
+        compression.set_enabled(true);
+        compression.set_offer_interval(5);
+        compression.reserve(1000);
+        compression.add_dictionary(1, DICTIONARY);
+        offer(now);
+    }
+
+    void offer(double now)
+    {
+        WireFrame f;
+        compression.make_offer(&f.wire, now);
+        out.push_back(f);
+    }
+};
+
+std::string app_frame(int t)
+{
+    switch (t % 8)
+    {
+        case 1: return std::string("\x1b" "EVZ\x02\x03\x00", 7);
+        case 3: return std::string("\x1b\x85zzz", 5);
+        case 5: return std::string("\x1b" "EVBD payload", 13);
+        case 7: return std::string("\x1b\x00", 2);
+        default: return "telemetry depth=12.5 heading=270 speed=1.2 t=" + std::to_string(t);
+    }
+}
+} // namespace
+
+int main()
+{
+    const int trials = 20;
+    const int ticks = 2000;
+    // longer than two of the longest offer backoffs
+    const int clear_ticks = 400;
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    long sent = 0, delivered = 0, corrupt = 0, as_offer = 0, invalid = 0, unsettled = 0;
+    for (double loss : {0.0, 0.3, 0.6})
+    {
+        unsigned long compressed = 0;
+        for (int trial = 0; trial < trials; trial++)
+        {
+            End ends[2];
+            ends[0].start(0);
+            ends[1].start(0);
+
+            for (int t = 1; t < ticks + clear_ticks; t++)
+            {
+                // the peer restarts and forgets everything it agreed
+                if (t == ticks / 2 && trial % 2 == 0)
+                    ends[1].start(t);
+
+                for (End& end : ends)
+                {
+                    WireFrame f;
+                    f.sent = app_frame(t);
+                    end.compression.encode(f.sent, &f.wire);
+                    end.out.push_back(f);
+                    sent++;
+                    if (end.compression.offer_due(t))
+                        end.offer(t);
+                }
+
+                for (int k = 0; k < 2; k++)
+                {
+                    End& src = ends[k];
+                    End& dst = ends[1 - k];
+                    while (!src.out.empty())
+                    {
+                        WireFrame f = src.out.front();
+                        src.out.pop_front();
+                        if (t < ticks && uniform(rng) < loss)
+                            continue;
+
+                        std::string decoded;
+                        bool send_offer = false;
+                        switch (dst.compression.decode(f.wire, &decoded, &send_offer))
+                        {
+                            case EvologicsCompression::Frame::OFFER:
+                                if (!f.sent.empty())
+                                    as_offer++;
+                                if (send_offer)
+                                    dst.offer(t);
+                                break;
+
+                            case EvologicsCompression::Frame::INVALID: invalid++; break;
+
+                            case EvologicsCompression::Frame::DATA:
+                                delivered++;
+                                if (f.sent.empty() || decoded != f.sent)
+                                    corrupt++;
+                                break;
+                        }
+                    }
+                }
+            }
+
+            if (!ends[0].compression.negotiated() || !ends[1].compression.negotiated())
+                unsettled++;
+            compressed += ends[0].compression.stats().frames_compressed;
+        }
+        std::printf("loss %.1f: %lu frames compressed\n", loss, compressed);
+    }
+
+    std::printf("%ld frames sent, %ld delivered, %ld corrupt, %ld taken for offers, %ld failed "
+                "to decompress, %ld runs without compression at the end\n",
+                sent, delivered, corrupt, as_offer, invalid, unsettled);
+
+    if (corrupt != 0 || as_offer != 0)
+    {
+        std::printf("FAIL: data frames were corrupted or lost as offers\n");
+        return 1;
+    }
+    if (unsettled != 0)
+    {
+        std::printf("FAIL: ends did not settle on compressing\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+// Replays a long traffic capture through the whole driver, built against the goby stub in
+// test/goby_stub, in the fixed memory mode and fails if do_work() or a transmission touches
+// the heap once the driver is up: notifications, replies, USBL fixes, long RECVIM/RECV lines,
+// data frames through ModemRaw and receive_msg_, transmissions through transmit_msg_, and the
+// outbound ring while the link is down.
+
+#include <cstdio>  // for printf
+#include <cstdlib> // for malloc, free
+#include <new>     // for bad_alloc
+#include <string>  // for string
+
+#include "evologics_driver.h"
+
+namespace
+{
+bool counting = false;
+long allocations = 0;
+} // namespace
+
+void* operator new(size_t n)
+{
+    if (counting)
+        allocations++;
+    void* p = std::malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+using goby::acomms::EvologicsDriver;
+using goby::acomms::EvologicsSetting;
+using goby::acomms::EvologicsSettings;
+
+namespace
+{
+std::string notification(const std::string& body)
+{
+    return "+++AT:" + std::to_string(body.size()) + ":" + body + "\r\n";
+}
+
+std::string reply(const std::string& command, const std::string& payload)
+{
+    return "+++AT" + command + ":" + std::to_string(payload.size()) + ":" + payload + "\r\n";
+}
+} // namespace
+
+int main()
+{
+    const int rounds = 5000;
+
+    EvologicsDriver driver;
+    driver.set_fixed_memory(EvologicsDriver::FixedMemoryConfig());
+    driver.set_outbound_queue_size(16);
+
+    long fixes = 0, frames = 0, notifications = 0, errors = 0, transmits = 0, raw_out = 0;
+    driver.set_usbl_callback([&](EvologicsDriver::UsbllongMsg) { fixes++; });
+    driver.set_angles_callback([&](EvologicsDriver::UsblAnglesMsg) { fixes++; });
+    driver.set_phyd_callback([&](EvologicsDriver::UsblPhydMsg) { fixes++; });
+    driver.set_transmit_callback([&](bool) { transmits++; });
+    driver.set_notification_callback([&](const std::string&, const std::string&) { notifications++; });
+    driver.set_decode_error_callback([&](hayes::AtStatus, const std::string&) { errors++; });
+    driver.signal_receive.connect([&](const goby::acomms::protobuf::ModemTransmission&) { frames++; });
+    driver.signal_raw_outgoing.connect([&](const goby::acomms::protobuf::ModemRaw&) { raw_out++; });
+
+    goby::acomms::protobuf::DriverConfig cfg;
+    cfg.set_connection_type(goby::acomms::protobuf::DriverConfig::CONNECTION_TCP_AS_CLIENT);
+    driver.startup(cfg);
+
+    // answer the startup read so nothing is held behind it
+    for (EvologicsSetting setting : EvologicsSettings::all())
+        driver.rx_lines.push_back(reply(EvologicsSettings::query_command(setting), "1"));
+    driver.do_work();
+    driver.rx_lines.clear();
+    driver.rx_next = 0;
+
+    driver.rx_lines = {
+        notification("USBLLONG,100.500,100.000,2,1.5,2.5,3.5,4.5,5.5,6.5,0.1,0.2,0.3,750,-50,200,0.5"),
+        notification("USBLANGLES,100.500,100.000,2,1.5,2.5,3.5,4.5,0.1,0.2,0.3,-50,200,0.5"),
+        notification("USBLPHYD,100.500,100.000,2,1,10,20,30,40,50,60,70,80"),
+        notification("SENDSTART,2,100,1,2"),
+        notification("SENDEND,2,100,1,2"),
+        notification("DELIVEREDIM,2"),
+        notification("RECVIM,64,2,1,ack,1500,-48,190,0.2," + std::string(64, 'i')),
+        notification("RECV,900,2,1,13923,-50,180,2500,0.1," + std::string(900, 'r')),
+        reply("?G", "3"),
+        reply("!G1", "OK"),
+        "+++AT:garbage\r\n",
+        std::string(900, 'x') + "\r\n",
+        "short frame\r\n",
+        // an application frame that starts like a bulk transfer frame, escaped by the sender
+        std::string("\x1b\x00\x1b" "EVBD not bulk\r\n", 18),
+    };
+
+    goby::acomms::protobuf::ModemTransmission transmission;
+    transmission.set_type(goby::acomms::protobuf::ModemTransmission::DATA);
+    transmission.add_frame(std::string(900, 't'));
+
+    driver.record_tx = false;
+
+    auto replay = [&](int n) {
+        for (int i = 0; i < n; i++)
+        {
+            driver.rx_next = 0;
+            driver.do_work();
+            driver.handle_initiate_transmission(transmission);
+        }
+    };
+
+    counting = true;
+    replay(rounds);
+    counting = false;
+    long connected_allocations = allocations;
+
+    // while the link is down every write goes to the outbound ring, which wraps many times
+    driver.link_open = false;
+    driver.handle_initiate_transmission(transmission);
+    allocations = 0;
+    counting = true;
+    for (int i = 0; i < rounds; i++) driver.handle_initiate_transmission(transmission);
+    counting = false;
+    long ring_allocations = allocations;
+
+    std::printf("replayed %d rounds: %ld fixes, %ld frames, %ld notifications, %ld decode errors, "
+                "%ld transmit, %ld raw out, %zu writes, %ld outbound dropped; %ld allocations "
+                "connected, %ld with the link down, %zu bytes reserved\n",
+                rounds, fixes, frames, notifications, errors, transmits, raw_out, driver.tx_count,
+                static_cast<long>(driver.outbound_queue_dropped()), connected_allocations,
+                ring_allocations, driver.fixed_memory_bytes());
+
+    if (fixes != 3L * rounds || frames != 3L * rounds || errors != rounds ||
+        raw_out < 2L * rounds)
+    {
+        std::printf("FAIL: capture was not decoded or sent\n");
+        return 1;
+    }
+    if (connected_allocations != 0 || ring_allocations != 0)
+    {
+        std::printf("FAIL: steady state path allocated\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+    Author: Jason Miller, jason_miller@uri.edu
+    Year: 2023
+
+    Copyright (C) 2023 Smart Ocean Systems Laboratory
+*/
+
+// Replays a long synthetic traffic capture through the protocol core after reserve()
+// and fails if the receive or transmit path touches the heap.
+
+#include <cstdio>  // for printf, snprintf
+#include <cstdlib> // for malloc, free
+#include <new>     // for bad_alloc
+#include <string>  // for string
+#include <vector>  // for vector
+
+#include "evologics_protocol.h"
+
+namespace
+{
+bool counting = false;
+long allocations = 0;
+} // namespace
+
+void* operator new(size_t n)
+{
+    if (counting)
+        allocations++;
+    void* p = std::malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+using goby::acomms::EvologicsProtocol;
+
+int main()
+{
+    const size_t max_line = 1100;
+    const size_t max_fields = 32;
+    const int rounds = 20000;
+
+    EvologicsProtocol protocol;
+    protocol.set_link(EvologicsProtocol::Link::TCP);
+    protocol.reserve(max_line, max_fields);
+
+    long fixes = 0, frames = 0, replies = 0, transmits = 0, delivered = 0, notifications = 0,
+         errors = 0;
+    std::string tx_line;
+    tx_line.reserve(max_line);
+
+    protocol.set_usbl_callback([&](const EvologicsProtocol::UsbllongMsg&) { fixes++; });
+    protocol.set_angles_callback([&](const EvologicsProtocol::UsblAnglesMsg&) { fixes++; });
+    protocol.set_phyd_callback([&](const EvologicsProtocol::UsblPhydMsg&) { fixes++; });
+    protocol.set_transmit_callback([&](bool) { transmits++; });
+    protocol.set_instant_message_callback([&](int, bool) { delivered++; });
+    protocol.set_reply_callback([&](const std::string&) { replies++; });
+    protocol.set_data_callback([&](std::string&) { frames++; });
+    protocol.set_notification_callback([&](const std::string&, std::string_view) { notifications++; });
+    protocol.set_decode_error_callback([&](hayes::AtStatus, std::string_view) { errors++; });
+    protocol.set_command_callback(
+        [&](const std::string& command) { protocol.frame_command(command, &tx_line); });
+
+    // outgoing traffic: a USBL ping, a setting write and a data frame
+    hayes::AtMsg ping;
+    ping.command = "*SENDIM";
+    ping.data = {"1", "2", "ack", "P"};
+    hayes::AtMsg gain;
+    gain.command = "!G1";
+    std::string payload(900, 'x');
+
+    // received messages whose last field is longer than any small string buffer
+    auto notification = [](const std::string& body) {
+        return "+++AT:" + std::to_string(body.size()) + ":" + body + "\r\n";
+    };
+    const std::string recvim =
+        notification("RECVIM,64,2,1,ack,1500,-48,190,0.2," + std::string(64, 'i'));
+    const std::string recv =
+        notification("RECV,900,2,1,13923,-50,180,2500,0.1," + std::string(900, 'r'));
+
+    std::string line;
+    line.reserve(max_line);
+    std::string long_line;
+    long_line.reserve(max_line);
+    char buf[512];
+
+    auto replay = [&](int n) {
+        for (int i = 0; i < n; i++)
+        {
+            double t = 100.0 + i;
+            const char* at[] = {
+                "+++AT:120:USBLLONG,%.3f,%.3f,2,1.5,2.5,3.5,4.5,5.5,6.5,0.1,0.2,0.3,0.75,-50,200,0.5\r\n",
+                "+++AT:80:USBLANGLES,%.3f,%.3f,2,1.5,2.5,3.5,4.5,0.1,0.2,0.3,-50,200,0.5\r\n",
+                "+++AT:60:USBLPHYD,%.3f,%.3f,2,1,10,20,30,40,50,60,70,80\r\n",
+            };
+            for (const char* fmt : at)
+            {
+                std::snprintf(buf, sizeof(buf), fmt, t + 0.5, t);
+                line.assign(buf);
+                protocol.process_line(line, t + 0.6);
+            }
+
+            const char* fixed[] = {
+                "+++AT:7:SENDSTART,2,100,1,2\r\n",
+                "+++AT:7:SENDEND,2,100,1,2\r\n",
+                "+++AT:13:DELIVEREDIM,2\r\n",
+                "+++AT:10:FAILEDIM,2\r\n",
+                "+++AT?G:1:3\r\n",
+                "+++AT!G1:2:OK\r\n",
+                "binary then+++AT:7:SENDEND,2,100,1,2\r\n",
+                "+++AT:20:USBLLONG,not,a,number\r\n",
+                "+++AT:garbage\r\n",
+            };
+            for (const char* l : fixed)
+            {
+                line.assign(l);
+                protocol.process_line(line, t);
+            }
+
+            for (const std::string* l : {&recvim, &recv})
+            {
+                long_line.assign(*l);
+                protocol.process_line(long_line, t);
+            }
+
+            line.assign(payload);
+            line.append("\r\n");
+            protocol.process_line(line, t);
+
+            protocol.encode(ping);
+            protocol.encode(gain);
+            protocol.frame_data(payload, &tx_line);
+        }
+    };
+
+    // everything after reserve() counts, first use of each path included
+    counting = true;
+    replay(rounds);
+    counting = false;
+
+    std::printf("replayed %d rounds: %ld fixes, %ld frames, %ld replies, %ld transmit, %ld delivery, "
+                "%ld notifications, %ld decode errors, %ld allocations, %zu bytes reserved\n",
+                rounds, fixes, frames, replies, transmits, delivered, notifications, errors,
+                allocations, protocol.reserved_bytes());
+
+    if (fixes == 0 || frames == 0 || replies == 0 || errors == 0)
+    {
+        std::printf("FAIL: capture was not decoded\n");
+        return 1;
+    }
+    // two replies and two bad lines ("not,a,number" and "garbage") per round
+    if (replies != 2L * rounds || errors != 2L * rounds || notifications != 10L * rounds)
+    {
+        std::printf("FAIL: replies, errors or notifications miscounted\n");
+        return 1;
+    }
+    if (allocations != 0)
+    {
+        std::printf("FAIL: steady state path allocated\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,4 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
+
+#include "dccl/common.h"
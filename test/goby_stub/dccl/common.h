@@ -0,0 +1,9 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
+
+namespace dccl
+{
+class Codec
+{
+};
+} // namespace dccl
@@ -0,0 +1,2 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
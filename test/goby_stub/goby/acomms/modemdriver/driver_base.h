@@ -0,0 +1,80 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <boost/signals2/signal.hpp>
+
+#include "goby/acomms/modemdriver/driver_exception.h"
+#include "goby/acomms/protobuf/driver_base.pb.h"
+#include "goby/acomms/protobuf/modem_message.pb.h"
+
+namespace goby
+{
+namespace acomms
+{
+/// The parts of goby's ModemDriverBase the driver uses, with the physical link replaced by
+/// in-memory lines the test controls.
+class ModemDriverBase
+{
+  public:
+    virtual ~ModemDriverBase() = default;
+
+    virtual void startup(const protobuf::DriverConfig& cfg) = 0;
+    virtual void shutdown() = 0;
+    virtual void do_work() = 0;
+    virtual void handle_initiate_transmission(const protobuf::ModemTransmission& m) = 0;
+
+    boost::signals2::signal<void(const protobuf::ModemTransmission&)> signal_receive;
+    boost::signals2::signal<void(const protobuf::ModemTransmission&)> signal_transmit_result;
+    boost::signals2::signal<void(protobuf::ModemTransmission*)> signal_data_request;
+    boost::signals2::signal<void(protobuf::ModemTransmission*)> signal_modify_transmission;
+    boost::signals2::signal<void(const protobuf::ModemRaw&)> signal_raw_incoming;
+    boost::signals2::signal<void(const protobuf::ModemRaw&)> signal_raw_outgoing;
+
+    // the link as the test sees it: lines still to be read (from rx_next on), every line
+    // written unless record_tx is off, and whether the link is up
+    std::vector<std::string> rx_lines;
+    size_t rx_next{0};
+    std::vector<std::string> tx_lines;
+    size_t tx_count{0};
+    bool record_tx{true};
+    bool link_open{false};
+    bool fail_start{false};
+
+  protected:
+    void modem_start(const protobuf::DriverConfig&)
+    {
+        if (fail_start)
+            throw ModemDriverException("Failed to startup.");
+        link_open = true;
+    }
+
+    void modem_close() { link_open = false; }
+
+    bool modem_read(std::string* in)
+    {
+        if (!link_open)
+            throw ModemDriverException("Modem physical connection failed.");
+        if (rx_next == rx_lines.size())
+            return false;
+        in->assign(rx_lines[rx_next++]);
+        return true;
+    }
+
+    void modem_write(const std::string& out)
+    {
+        if (!link_open)
+            throw ModemDriverException("Modem physical connection failed.");
+        tx_count++;
+        if (record_tx)
+            tx_lines.push_back(out);
+    }
+
+    int glog_out_group() const { return 0; }
+    int glog_in_group() const { return 0; }
+};
+} // namespace acomms
+} // namespace goby
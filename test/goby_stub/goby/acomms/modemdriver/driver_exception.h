@@ -0,0 +1,16 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
+
+#include <stdexcept>
+
+namespace goby
+{
+namespace acomms
+{
+class ModemDriverException : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+} // namespace acomms
+} // namespace goby
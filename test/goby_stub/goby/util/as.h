@@ -0,0 +1,19 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
+
+#include <sstream>
+
+namespace goby
+{
+namespace util
+{
+template <typename To, typename From> To as(const From& from)
+{
+    std::stringstream ss;
+    ss << from;
+    To to{};
+    ss >> to;
+    return to;
+}
+} // namespace util
+} // namespace goby
@@ -0,0 +1,33 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace goby
+{
+namespace util
+{
+inline std::string hex_encode(const std::string& s)
+{
+    std::string out;
+    char b[3];
+    for (unsigned char c : s)
+    {
+        std::snprintf(b, sizeof(b), "%02x", c);
+        out += b;
+    }
+    return out;
+}
+
+// like goby's, bad input decodes to garbage rather than failing
+inline std::string hex_decode(const std::string& s)
+{
+    std::string out;
+    for (size_t i = 0; i + 1 < s.size(); i += 2)
+        out.push_back(static_cast<char>(std::strtol(s.substr(i, 2).c_str(), nullptr, 16)));
+    return out;
+}
+} // namespace util
+} // namespace goby
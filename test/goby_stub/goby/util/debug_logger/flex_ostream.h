@@ -0,0 +1,45 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
+
+#include <iostream>
+
+namespace goby
+{
+namespace util
+{
+namespace logger
+{
+enum Verbosity
+{
+    QUIET,
+    WARN,
+    VERBOSE,
+    DEBUG1,
+    DEBUG2,
+    DEBUG3
+};
+
+struct group
+{
+    group(int) {}
+};
+} // namespace logger
+
+namespace logger_lock
+{
+}
+namespace tcolor
+{
+}
+
+struct FlexOstream : std::ostream
+{
+    FlexOstream() : std::ostream(std::cout.rdbuf()) {}
+    bool is(logger::Verbosity) { return true; }
+};
+} // namespace util
+
+inline std::ostream& operator<<(std::ostream& out, const util::logger::group&) { return out; }
+
+extern util::FlexOstream glog;
+} // namespace goby
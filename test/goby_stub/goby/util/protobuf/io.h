@@ -0,0 +1,17 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#pragma once
+
+#include <ostream>
+
+#include <google/protobuf/message.h>
+
+namespace google
+{
+namespace protobuf
+{
+inline std::ostream& operator<<(std::ostream& out, const Message& msg)
+{
+    return out << msg.ShortDebugString();
+}
+} // namespace protobuf
+} // namespace google
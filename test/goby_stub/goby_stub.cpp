@@ -0,0 +1,4 @@
+// goby stub for the driver tests, see test/goby_stub/README.md
+#include "goby/util/debug_logger/flex_ostream.h"
+
+goby::util::FlexOstream goby::glog;